@@ -0,0 +1,4445 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdio>
+#include <memory_resource>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HASHMAP_HAVE_USDT 1
+#endif
+#endif
+
+/// One control byte per slot. EMPTY and DELETED have the high bit set,
+/// a full slot stores the low 7 bits of its hash (H2) and is never negative.
+using ctrl_t = int8_t;
+
+enum status : ctrl_t {
+    EMPTY = -128,
+    DELETED = -2
+};
+
+inline bool is_full(ctrl_t c) {
+    return c >= 0;
+}
+
+/// Index of the lowest set bit of a non-zero group mask.
+inline std::size_t lowest_bit(uint32_t mask) {
+    return static_cast<std::size_t>(__builtin_ctz(mask));
+}
+
+/**
+ *  @brief  A run of control bytes that is matched all at once.
+ *
+ *  Each match returns a bitmask with bit i set when byte i of the group
+ *  matches. The group is 32 bytes wide with AVX2, 16 with SSE2 and 8 on
+ *  the portable fallback.
+ */
+struct ctrl_group {
+#if defined(__AVX2__)
+    static constexpr std::size_t width = 32;
+
+    __m256i ctrl;
+
+    explicit ctrl_group(const ctrl_t *pos)
+            : ctrl(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos))) {}
+
+    uint32_t match(ctrl_t h2) const {
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(h2), ctrl)));
+    }
+
+    uint32_t match_empty_or_deleted() const {
+        return static_cast<uint32_t>(_mm256_movemask_epi8(ctrl));
+    }
+
+    uint32_t match_full() const {
+        return ~match_empty_or_deleted();
+    }
+#elif defined(__SSE2__)
+    static constexpr std::size_t width = 16;
+
+    __m128i ctrl;
+
+    explicit ctrl_group(const ctrl_t *pos)
+            : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pos))) {}
+
+    uint32_t match(ctrl_t h2) const {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)));
+    }
+
+    uint32_t match_empty_or_deleted() const {
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+    }
+
+    uint32_t match_full() const {
+        return ~match_empty_or_deleted() & 0xFFFFu;
+    }
+#else
+    static constexpr std::size_t width = 8;
+
+    ctrl_t ctrl[width];
+
+    explicit ctrl_group(const ctrl_t *pos) {
+        std::copy(pos, pos + width, ctrl);
+    }
+
+    uint32_t match(ctrl_t h2) const {
+        uint32_t mask = 0;
+        for (std::size_t i = 0; i < width; ++i)
+            mask |= static_cast<uint32_t>(ctrl[i] == h2) << i;
+        return mask;
+    }
+
+    uint32_t match_empty_or_deleted() const {
+        uint32_t mask = 0;
+        for (std::size_t i = 0; i < width; ++i)
+            mask |= static_cast<uint32_t>(ctrl[i] < 0) << i;
+        return mask;
+    }
+
+    uint32_t match_full() const {
+        return ~match_empty_or_deleted() & 0xFFu;
+    }
+#endif
+
+    uint32_t match_empty() const {
+        return match(EMPTY);
+    }
+};
+
+/// First full slot at or after @a i, or @a capacity when there is none.
+/// Skips a whole group of empty or deleted slots per step.
+inline std::size_t next_full_slot(const ctrl_t *ctrl, std::size_t capacity, std::size_t i) {
+    while (i < capacity) {
+        uint32_t mask = ctrl_group(ctrl + i).match_full();
+        if (mask != 0) {
+            i += lowest_bit(mask);
+            return i < capacity ? i : capacity;
+        }
+        i += ctrl_group::width;
+    }
+    return capacity;
+}
+
+/**
+ *  @brief  ctrl_group::width bytes of integer keys compared with one key at once.
+ *
+ *  A match returns a byte mask like ctrl_group does, so a matching key sets
+ *  sizeof(K) consecutive bits; slot() turns the lowest of them back into
+ *  the key's index within the group.
+ */
+template<typename K>
+struct key_group {
+    static_assert(std::is_integral<K>::value && sizeof(K) <= 8 && (sizeof(K) & (sizeof(K) - 1)) == 0,
+                  "key_group compares 1, 2, 4 or 8-byte integers");
+
+    static constexpr std::size_t width = ctrl_group::width / sizeof(K);
+
+#if defined(__AVX2__)
+    __m256i keys;
+
+    explicit key_group(const K *pos)
+            : keys(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos))) {}
+
+    uint32_t match(K key) const {
+        __m256i eq;
+        if constexpr (sizeof(K) == 1)
+            eq = _mm256_cmpeq_epi8(keys, _mm256_set1_epi8(static_cast<char>(key)));
+        else if constexpr (sizeof(K) == 2)
+            eq = _mm256_cmpeq_epi16(keys, _mm256_set1_epi16(static_cast<short>(key)));
+        else if constexpr (sizeof(K) == 4)
+            eq = _mm256_cmpeq_epi32(keys, _mm256_set1_epi32(static_cast<int>(key)));
+        else
+            eq = _mm256_cmpeq_epi64(keys, _mm256_set1_epi64x(static_cast<long long>(key)));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+    }
+#elif defined(__SSE2__)
+    __m128i keys;
+
+    explicit key_group(const K *pos)
+            : keys(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pos))) {}
+
+    uint32_t match(K key) const {
+        __m128i eq;
+        if constexpr (sizeof(K) == 1) {
+            eq = _mm_cmpeq_epi8(keys, _mm_set1_epi8(static_cast<char>(key)));
+        } else if constexpr (sizeof(K) == 2) {
+            eq = _mm_cmpeq_epi16(keys, _mm_set1_epi16(static_cast<short>(key)));
+        } else if constexpr (sizeof(K) == 4) {
+            eq = _mm_cmpeq_epi32(keys, _mm_set1_epi32(static_cast<int>(key)));
+        } else {
+            // SSE2 has no 64-bit compare: both 32-bit halves have to match.
+            __m128i halves = _mm_cmpeq_epi32(keys, _mm_set1_epi64x(static_cast<long long>(key)));
+            eq = _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+        }
+        return static_cast<uint32_t>(_mm_movemask_epi8(eq));
+    }
+#else
+    K keys[width];
+
+    explicit key_group(const K *pos) {
+        std::copy(pos, pos + width, keys);
+    }
+
+    uint32_t match(K key) const {
+        uint32_t mask = 0;
+        for (std::size_t i = 0; i < width; ++i) {
+            if (keys[i] == key)
+                mask |= ((uint32_t(1) << sizeof(K)) - 1) << (i * sizeof(K));
+        }
+        return mask;
+    }
+#endif
+
+    static std::size_t slot(uint32_t mask) {
+        return lowest_bit(mask) / sizeof(K);
+    }
+};
+
+
+/**
+ *  Allocator used by hash_map. By default it calls the global operator new;
+ *  given a std::pmr::memory_resource (a monotonic_buffer_resource arena, a
+ *  pool, ...) it allocates from that instead and passes the resource on to
+ *  elements that take a polymorphic_allocator, such as std::pmr::string, so
+ *  a map and everything in it can live in one region.
+ */
+template<typename T>
+class My_allocator {
+public:
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T *;
+    using const_pointer = const T *;
+    using reference = typename std::add_lvalue_reference<T>::type;
+    using const_reference = typename std::add_lvalue_reference<const T>::type;
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template<class U>
+    struct rebind {
+        using other = My_allocator<U>;
+    };
+
+    My_allocator() noexcept = default;
+
+    My_allocator(std::pmr::memory_resource *resource) noexcept: resource_(resource) {}
+
+    My_allocator(const My_allocator &) noexcept = default;
+
+    template<class U>
+    explicit My_allocator(const My_allocator<U> &other) noexcept : resource_(other.resource()) {}
+
+    ~My_allocator() = default;
+
+    pointer allocate(size_type n) {
+        if (resource_ != nullptr)
+            return static_cast<pointer>(resource_->allocate(sizeof(T) * n, alignof(T)));
+        return static_cast<pointer>(::operator new(sizeof(T) * n));
+    }
+
+    void deallocate(pointer p, size_type n) noexcept {
+        if (resource_ != nullptr)
+            resource_->deallocate(p, sizeof(T) * n, alignof(T));
+        else
+            ::operator delete(p, n * sizeof(value_type));
+    }
+
+    /// Uses-allocator construction when a resource is set, placement new otherwise.
+    template<typename U, typename... Args>
+    void construct(U *p, Args &&... args) {
+        if (resource_ != nullptr)
+            std::pmr::polymorphic_allocator<U>(resource_).construct(p, std::forward<Args>(args)...);
+        else
+            ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+
+    /// nullptr for the global heap.
+    std::pmr::memory_resource *resource() const noexcept {
+        return resource_;
+    }
+
+    template<class U>
+    bool operator==(const My_allocator<U> &other) const noexcept {
+        return resource_ == other.resource();
+    }
+
+    template<class U>
+    bool operator!=(const My_allocator<U> &other) const noexcept {
+        return resource_ != other.resource();
+    }
+
+private:
+    std::pmr::memory_resource *resource_ = nullptr;
+};
+
+#if defined(__linux__)
+
+/**
+ *  memory_resource for very large tables: allocations of at least
+ *  min_mapping bytes are mapped straight from the kernel, 2 MiB aligned and
+ *  backed by huge pages where possible, so random probes into a multi-GB
+ *  table stop missing the TLB. Smaller requests go to @a upstream.
+ *
+ *  explicit_huge asks for MAP_HUGETLB pages and, when none are reserved,
+ *  falls back to transparent huge pages (madvise(MADV_HUGEPAGE)); small
+ *  pages maps plain 4 KiB pages, for comparison. Mappings can optionally be
+ *  interleaved or bound across NUMA nodes with mbind; a failing mbind leaves
+ *  the mapping on the default policy.
+ *
+ *  Use it through My_allocator: hash_map<K, T>(My_allocator<...>(&resource)).
+ */
+class huge_page_resource : public std::pmr::memory_resource {
+public:
+    enum class pages {
+        small, transparent, explicit_huge
+    };
+
+    enum class numa {
+        none, interleave, bind
+    };
+
+    static constexpr std::size_t huge_page_size = std::size_t(2) << 20;
+    static constexpr std::size_t min_mapping = std::size_t(1) << 20;
+
+    explicit huge_page_resource(pages mode = pages::transparent, numa policy = numa::none,
+                                unsigned long node_mask = 0,
+                                std::pmr::memory_resource *upstream = std::pmr::new_delete_resource()) noexcept:
+            mode_(mode), policy_(policy), node_mask_(node_mask), upstream_(upstream) {}
+
+    /// Mappings that wanted MAP_HUGETLB but got transparent huge pages instead.
+    std::size_t huge_page_fallbacks() const noexcept {
+        return fallbacks_;
+    }
+
+    /// Mappings whose mbind call failed.
+    std::size_t numa_failures() const noexcept {
+        return numa_failures_;
+    }
+
+private:
+    pages mode_;
+    numa policy_;
+    unsigned long node_mask_;
+    std::pmr::memory_resource *upstream_;
+    std::atomic<std::size_t> fallbacks_{0}, numa_failures_{0};
+
+    static std::size_t mapping_size(std::size_t bytes) {
+        return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+    }
+
+    /// Maps @a size bytes of 4 KiB pages aligned to huge_page_size by
+    /// over-mapping and trimming both ends.
+    static void *map_aligned(std::size_t size) {
+        void *raw = mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            throw std::bad_alloc();
+        auto begin = reinterpret_cast<std::uintptr_t>(raw);
+        auto aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+        if (aligned != begin)
+            munmap(raw, aligned - begin);
+        munmap(reinterpret_cast<void *>(aligned + size), begin + huge_page_size - aligned);
+        return reinterpret_cast<void *>(aligned);
+    }
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes < min_mapping || alignment > huge_page_size)
+            return upstream_->allocate(bytes, alignment);
+        std::size_t size = mapping_size(bytes);
+        void *p = MAP_FAILED;
+        if (mode_ == pages::explicit_huge) {
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p == MAP_FAILED)
+                ++fallbacks_;
+        }
+        if (p == MAP_FAILED) {
+            p = map_aligned(size);
+            if (mode_ != pages::small)
+                madvise(p, size, MADV_HUGEPAGE);
+            else
+                madvise(p, size, MADV_NOHUGEPAGE);
+        }
+        if (policy_ != numa::none) {
+            // MPOL_BIND and MPOL_INTERLEAVE from <numaif.h>, spelled out to avoid depending on libnuma.
+            const int mode = policy_ == numa::bind ? 2 : 3;
+            if (syscall(SYS_mbind, p, size, mode, &node_mask_, sizeof(node_mask_) * 8, 0) != 0)
+                ++numa_failures_;
+        }
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+        if (bytes < min_mapping || alignment > huge_page_size)
+            upstream_->deallocate(p, bytes, alignment);
+        else
+            munmap(p, mapping_size(bytes));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+#endif
+
+/**
+ *  Tuning knobs for hash_map, bundled in one struct so adding a knob does not
+ *  change every declaration. Derive from it and override what you need.
+ */
+struct swiss_probing;
+struct no_tracer;
+struct robin_hood_probing;
+struct fastrange_index;
+
+struct hash_map_policy {
+    /// How slots are probed: swiss_probing or robin_hood_probing.
+    using probing = swiss_probing;
+
+    /// How a hash picks the home slot: fastrange_index, pow2_index or modulo_index.
+    using bucket_index = fastrange_index;
+
+    /// Slots of the old table migrated by each insert/find/erase while a resize
+    /// is in progress. 0 rebuilds the whole table inside the insert that grows it.
+    static constexpr std::size_t rehash_step = 0;
+
+    /// Initial hash_map::max_load_factor(); it can be changed at run time.
+    static constexpr float max_load_factor = 0.5f;
+
+    /// An insert that has to walk at least this many slots from its home
+    /// slot makes the next insert grow the table if it is at least half as
+    /// full as max_load_factor allows, so clustering cannot build up
+    /// unchecked at high load factors. 0 grows on load alone.
+    static constexpr std::size_t max_probe_length = 1024;
+
+    /// erase halves the table when the load drops below this; 0 never shrinks,
+    /// and clear() then keeps the table too. Keep it under a quarter of
+    /// max_loadfactor so a halved table does not have to grow right back.
+    static constexpr float shrink_load_factor = 0;
+
+    /// Count probe lengths and rehash time for hash_map::stats(). When false
+    /// the counters are not even members and every hook compiles away.
+    static constexpr bool collect_stats = false;
+
+    /// Per-operation latency hooks: no_tracer or latency_tracer<Clock>.
+    using tracer = no_tracer;
+};
+
+/// Fills tables to 7/8 before growing: about half the memory of the default
+/// for small entries, at the price of longer probes.
+struct dense_policy : hash_map_policy {
+    static constexpr float max_load_factor = 0.875f;
+};
+
+/// Spreads every resize over the following operations, 16 slots at a time,
+/// so no single insert pays for copying the whole table.
+struct incremental_rehash_policy : hash_map_policy {
+    static constexpr std::size_t rehash_step = 16;
+};
+
+/**
+ *  Finalizer for hashers whose output is not well distributed, such as
+ *  std::hash for integers, which returns the key itself: a 64x64->128 bit
+ *  multiply by 2^64/phi with the two halves folded together.
+ */
+inline std::size_t mix_hash(std::size_t hash) {
+#if SIZE_MAX > UINT32_MAX
+    unsigned __int128 r = static_cast<unsigned __int128>(hash) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64));
+#else
+    uint64_t r = static_cast<uint64_t>(hash) * 0x9E3779B9u;
+    return static_cast<std::size_t>(static_cast<uint32_t>(r) ^ static_cast<uint32_t>(r >> 32));
+#endif
+}
+
+/// True for hashers whose every output bit already depends on every input
+/// bit; hash_map applies mix_hash to all others. A hasher opts in with
+/// `using is_avalanching = void;`.
+template<typename H, typename = void>
+struct is_avalanching : std::false_type {
+};
+
+template<typename H>
+struct is_avalanching<H, std::void_t<typename H::is_avalanching>> : std::true_type {
+};
+
+template<>
+struct is_avalanching<std::hash<std::string>> : std::true_type {
+};
+
+template<>
+struct is_avalanching<std::hash<std::string_view>> : std::true_type {
+};
+
+/// Top 7 bits of a hash.
+inline ctrl_t high_tag(std::size_t hash) {
+    return static_cast<ctrl_t>(hash >> (sizeof(std::size_t) * 8 - 7));
+}
+
+/**
+ *  Bucket-index policies map a (mixed) hash to a home slot. Each also says
+ *  which capacity it needs for a request of n slots and which 7 hash bits
+ *  go into the control byte, so the tag stays independent of the index.
+ */
+
+/// Lemire's fastrange: the high bits of hash * capacity. No division and any
+/// capacity, so hash_map(n) keeps exactly n buckets.
+struct fastrange_index {
+    static std::size_t capacity_for(std::size_t n) {
+        return n;
+    }
+
+    static std::size_t index(std::size_t hash, std::size_t capacity) {
+#if SIZE_MAX > UINT32_MAX
+        return static_cast<std::size_t>((static_cast<unsigned __int128>(hash) * capacity) >> 64);
+#else
+        return static_cast<std::size_t>((static_cast<uint64_t>(hash) * capacity) >> 32);
+#endif
+    }
+
+    static ctrl_t tag(std::size_t hash) {
+        return static_cast<ctrl_t>(hash & 0x7F);
+    }
+};
+
+/// Capacities rounded up to a power of two and indexed with a mask.
+struct pow2_index {
+    static std::size_t capacity_for(std::size_t n) {
+        std::size_t capacity = 1;
+        while (capacity < n)
+            capacity <<= 1;
+        return n == 0 ? 0 : capacity;
+    }
+
+    static std::size_t index(std::size_t hash, std::size_t capacity) {
+        return hash & (capacity - 1);
+    }
+
+    static ctrl_t tag(std::size_t hash) {
+        return high_tag(hash);
+    }
+};
+
+/// hash % capacity, one integer division per probe start.
+struct modulo_index {
+    static std::size_t capacity_for(std::size_t n) {
+        return n;
+    }
+
+    static std::size_t index(std::size_t hash, std::size_t capacity) {
+        return hash % capacity;
+    }
+
+    static ctrl_t tag(std::size_t hash) {
+        return high_tag(hash);
+    }
+};
+
+/// Linear probing over control-byte groups; erase leaves DELETED tombstones.
+struct swiss_probing {
+};
+
+/**
+ *  Robin Hood probing: a full slot's control byte holds its distance from
+ *  the home slot (saturating at 127), an insert takes the slot of the first
+ *  "richer" element it meets, and a lookup stops as soon as it meets one.
+ *  erase shifts the rest of the run back instead of leaving a tombstone.
+ */
+struct robin_hood_probing {
+};
+
+/// Tables that give memory back: erase halves a table once it is less than
+/// 1/8 full, and clear() frees it.
+struct shrink_policy : hash_map_policy {
+    static constexpr float shrink_load_factor = 0.125f;
+};
+
+/// Robin Hood probing with backward-shift deletion, for insert/erase churn.
+struct robin_hood_policy : hash_map_policy {
+    using probing = robin_hood_probing;
+};
+
+/// Default hash_map with hash_map::stats() enabled.
+struct stats_policy : hash_map_policy {
+    static constexpr bool collect_stats = true;
+};
+
+/**
+ *  @brief  Snapshot of a hash_map's health, from hash_map::stats().
+ *
+ *  A probe length is the number of control groups a lookup loaded, or of
+ *  slots it visited with Robin Hood probing. Bucket k of a histogram
+ *  counts lookups whose probe length was in [2^k, 2^(k+1)); the last
+ *  bucket also takes everything longer. Lookups include those made by
+ *  insert. While an incremental resize is in progress a lookup that
+ *  reaches the old table is counted once per table.
+ */
+struct hash_map_stats {
+    static constexpr std::size_t histogram_size = 16;
+
+    std::array<uint64_t, histogram_size> hit_probes{};
+    std::array<uint64_t, histogram_size> miss_probes{};
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+    std::size_t tombstones = 0;
+    /// Longest run of slots without an EMPTY one, wrapping around the end.
+    std::size_t max_cluster = 0;
+    uint64_t rehashes = 0;
+    std::chrono::nanoseconds rehash_time{0};
+    /// Slots and control bytes currently held, a table being drained included.
+    std::size_t bytes_allocated = 0;
+
+    double load_factor() const {
+        return capacity == 0 ? 0 : static_cast<double>(size) / capacity;
+    }
+
+    /// Mean probe length, taking each histogram bucket at its lower bound.
+    static double mean_probe_length(const std::array<uint64_t, histogram_size> &histogram) {
+        uint64_t lookups = 0;
+        double total = 0;
+        for (std::size_t k = 0; k < histogram_size; ++k) {
+            lookups += histogram[k];
+            total += static_cast<double>(histogram[k]) * static_cast<double>(uint64_t(1) << k);
+        }
+        return lookups == 0 ? 0 : total / lookups;
+    }
+
+    /// Multi-line human-readable report.
+    friend std::ostream &operator<<(std::ostream &out, const hash_map_stats &s) {
+        out << "size " << s.size << ", capacity " << s.capacity << ", load factor " << s.load_factor() << '\n'
+            << "tombstones " << s.tombstones << ", longest cluster " << s.max_cluster << '\n'
+            << "rehashes " << s.rehashes << ", rehash time "
+            << std::chrono::duration<double, std::milli>(s.rehash_time).count() << " ms\n"
+            << "bytes allocated " << s.bytes_allocated << '\n';
+        print_histogram(out, "hit", s.hit_probes);
+        print_histogram(out, "miss", s.miss_probes);
+        return out;
+    }
+
+private:
+    static void print_histogram(std::ostream &out, const char *name,
+                                const std::array<uint64_t, histogram_size> &histogram) {
+        out << name << " probe lengths (mean " << mean_probe_length(histogram) << "):";
+        for (std::size_t k = 0; k < histogram_size; ++k) {
+            if (histogram[k] == 0)
+                continue;
+            out << ' ' << (uint64_t(1) << k);
+            if (k + 1 == histogram_size)
+                out << '+';
+            else if (k != 0)
+                out << '-' << (uint64_t(2) << k) - 1;
+            out << ": " << histogram[k];
+        }
+        out << '\n';
+    }
+};
+
+enum class trace_op {
+    insert, find, erase, rehash
+};
+
+/**
+ *  @brief  Lock-free log-linear histogram in the style of HdrHistogram.
+ *
+ *  Values below 16 get a bucket each; above that every power of two is split
+ *  into 16 buckets, so a reported value is within 1/16 of the recorded one.
+ *  record() is a relaxed fetch_add and may run on any number of threads.
+ */
+class latency_histogram {
+public:
+    static constexpr unsigned sub_bucket_bits = 4;
+    static constexpr std::size_t bucket_count = (64 - sub_bucket_bits + 1) << sub_bucket_bits;
+
+    void record(uint64_t value) noexcept {
+        counts[index(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (value > seen && !largest.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const noexcept {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const noexcept {
+        return largest.load(std::memory_order_relaxed);
+    }
+
+    /// Upper bound of the bucket holding the value at quantile @a q in [0, 1].
+    uint64_t percentile(double q) const noexcept {
+        uint64_t n = count();
+        if (n == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * n))), seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(upper_bound(i), max());
+        }
+        return max();
+    }
+
+    void reset() noexcept {
+        for (auto &c : counts)
+            c.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        largest.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint64_t sub_bucket_mask = (uint64_t(1) << sub_bucket_bits) - 1;
+
+    std::array<std::atomic<uint64_t>, bucket_count> counts{};
+    std::atomic<uint64_t> total{0}, largest{0};
+
+    static std::size_t index(uint64_t value) {
+        if (value <= sub_bucket_mask)
+            return static_cast<std::size_t>(value);
+        unsigned shift = 63 - __builtin_clzll(value) - sub_bucket_bits;
+        return ((shift + 1) << sub_bucket_bits) + static_cast<std::size_t>((value >> shift) & sub_bucket_mask);
+    }
+
+    /// Largest value that lands in bucket @a i.
+    static uint64_t upper_bound(std::size_t i) {
+        if (i <= sub_bucket_mask)
+            return i;
+        unsigned shift = static_cast<unsigned>(i >> sub_bucket_bits) - 1;
+        uint64_t mantissa = (i & sub_bucket_mask) | (sub_bucket_mask + 1);
+        return ((mantissa + 1) << shift) - 1;
+    }
+};
+
+/// Time stamp counter: a few cycles to read, converted to nanoseconds with a
+/// rate measured against steady_clock on first use. Falls back to
+/// steady_clock_ticks off x86.
+struct tsc_clock {
+    static uint64_t now() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    static double ns_per_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+        static const double rate = [] {
+            auto wall_start = std::chrono::steady_clock::now();
+            uint64_t tsc_start = now();
+            while (std::chrono::steady_clock::now() - wall_start < std::chrono::milliseconds(10)) {
+            }
+            std::chrono::duration<double, std::nano> wall = std::chrono::steady_clock::now() - wall_start;
+            return wall.count() / static_cast<double>(now() - tsc_start);
+        }();
+        return rate;
+#else
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::duration(1)).count();
+#endif
+    }
+};
+
+struct steady_clock_ticks {
+    static uint64_t now() noexcept {
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+
+    static double ns_per_tick() {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::duration(1)).count();
+    }
+};
+
+/**
+ *  Markers around every rehash for perf and bpftrace: USDT probes
+ *  hashmap:rehash_begin(table, old capacity, new capacity) and
+ *  hashmap:rehash_end(table, capacity) when <sys/sdt.h> is available, and
+ *  always two never-inlined functions of the same names that
+ *  `perf probe -x <binary> hashmap_rehash_begin` can attach to.
+ */
+__attribute__((noinline)) inline void hashmap_rehash_begin(const void *table, std::size_t from, std::size_t to) {
+#if defined(HASHMAP_HAVE_USDT)
+    DTRACE_PROBE3(hashmap, rehash_begin, table, from, to);
+#endif
+    asm volatile("" : : "r"(table), "r"(from), "r"(to) : "memory");
+}
+
+__attribute__((noinline)) inline void hashmap_rehash_end(const void *table, std::size_t capacity) {
+#if defined(HASHMAP_HAVE_USDT)
+    DTRACE_PROBE2(hashmap, rehash_end, table, capacity);
+#endif
+    asm volatile("" : : "r"(table), "r"(capacity) : "memory");
+}
+
+/// Tracer that records nothing; every hook is empty and inlines away.
+struct no_tracer {
+    struct scope {
+    };
+
+    scope trace(trace_op) const noexcept {
+        return {};
+    }
+
+    void rehash_begin(const void *, std::size_t, std::size_t) const noexcept {}
+
+    void rehash_end(const void *, std::size_t) const noexcept {}
+};
+
+/**
+ *  @brief  Records the latency of every insert, find, erase and rehash of
+ *          one hash_map into a latency_histogram per operation.
+ *
+ *  insert covers every inserting call (emplace, try_emplace, operator[]...)
+ *  including any rehash it triggers; find covers find, contains, count
+ *  and at; erase includes its lookup. Timestamps come from Clock. The
+ *  tracer belongs to the hash_map object: swap and move leave it behind,
+ *  so its histograms always describe the table at one address. Name it to
+ *  tell tables apart in reports.
+ */
+template<typename Clock = tsc_clock>
+class latency_tracer {
+public:
+    class scope {
+    public:
+        explicit scope(latency_histogram &h) noexcept : histogram(h), start(Clock::now()) {}
+
+        scope(const scope &) = delete;
+
+        scope &operator=(const scope &) = delete;
+
+        ~scope() {
+            histogram.record(Clock::now() - start);
+        }
+
+    private:
+        latency_histogram &histogram;
+        uint64_t start;
+    };
+
+    latency_tracer() = default;
+
+    latency_tracer(const latency_tracer &) : latency_tracer() {}
+
+    latency_tracer &operator=(const latency_tracer &) noexcept {
+        return *this;
+    }
+
+    scope trace(trace_op op) noexcept {
+        return scope(histograms[static_cast<std::size_t>(op)]);
+    }
+
+    void rehash_begin(const void *table, std::size_t from, std::size_t to) const noexcept {
+        hashmap_rehash_begin(table, from, to);
+    }
+
+    void rehash_end(const void *table, std::size_t capacity) const noexcept {
+        hashmap_rehash_end(table, capacity);
+    }
+
+    const latency_histogram &histogram(trace_op op) const noexcept {
+        return histograms[static_cast<std::size_t>(op)];
+    }
+
+    /// Latency at quantile @a q of @a op, in nanoseconds.
+    double percentile_ns(trace_op op, double q) const {
+        return histogram(op).percentile(q) * Clock::ns_per_tick();
+    }
+
+    void set_name(std::string name) {
+        name_ = std::move(name);
+    }
+
+    const std::string &name() const noexcept {
+        return name_;
+    }
+
+    void reset() noexcept {
+        for (auto &h : histograms)
+            h.reset();
+    }
+
+    /// One line per operation with its count and p50/p90/p99/p99.9/max in ns.
+    friend std::ostream &operator<<(std::ostream &out, const latency_tracer &t) {
+        static const char *const names[] = {"insert", "find", "erase", "rehash"};
+        for (std::size_t i = 0; i < op_count; ++i) {
+            const latency_histogram &h = t.histograms[i];
+            if (h.count() == 0)
+                continue;
+            trace_op op = static_cast<trace_op>(i);
+            out << (t.name_.empty() ? "hash_map" : t.name_) << ' ' << names[i] << ": count " << h.count()
+                << ", p50 " << t.percentile_ns(op, 0.5) << " ns, p90 " << t.percentile_ns(op, 0.9)
+                << " ns, p99 " << t.percentile_ns(op, 0.99) << " ns, p99.9 " << t.percentile_ns(op, 0.999)
+                << " ns, max " << h.max() * Clock::ns_per_tick() << " ns\n";
+        }
+        return out;
+    }
+
+private:
+    static constexpr std::size_t op_count = 4;
+
+    std::array<latency_histogram, op_count> histograms;
+    std::string name_;
+};
+
+/// Default hash_map that records operation latencies with the time stamp counter.
+struct tracing_policy : hash_map_policy {
+    using tracer = latency_tracer<>;
+};
+
+template<typename K, typename T,
+        typename Hash = std::hash<K>,
+        typename Pred = std::equal_to<K>,
+        typename Alloc = My_allocator<std::pair<const K, T>>,
+        typename Policy = hash_map_policy>
+class hash_map;
+
+template<typename F, typename = void>
+struct is_transparent : std::false_type {
+};
+
+template<typename F>
+struct is_transparent<F, std::void_t<typename F::is_transparent>> : std::true_type {
+};
+
+/**
+ *  Transparent hasher for std::string keys. Together with std::equal_to<>
+ *  it lets hash_map<std::string, T, string_hash, std::equal_to<>> be searched
+ *  with a string_view or a const char * without building a std::string.
+ */
+struct string_hash {
+    using is_transparent = void;
+    using is_avalanching = void;
+
+    std::size_t operator()(std::string_view s) const noexcept {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+/// Duplicate-key policies for hash_map::bulk_insert: called with the mapped
+/// value already in the table and the one arriving for the same key.
+struct keep_first {
+    template<typename T>
+    void operator()(T &, const T &) const {}
+};
+
+struct keep_last {
+    template<typename T>
+    void operator()(T &existing, const T &incoming) const {
+        existing = incoming;
+    }
+};
+
+/**
+ *  How hash_map::save and hash_map::load write a key or a value.
+ *  Trivially copyable types go out as their bytes, strings as a length and
+ *  their characters; specialize it for anything else.
+ */
+template<typename T, typename = void>
+struct serializer;
+
+template<typename T>
+struct serializer<T, std::enable_if_t<std::is_trivially_copyable<T>::value>> {
+    static void write(std::ostream &out, const T &value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    static T read(std::istream &in) {
+        T value;
+        in.read(reinterpret_cast<char *>(&value), sizeof(T));
+        return value;
+    }
+};
+
+template<typename CharT, typename Traits, typename A>
+struct serializer<std::basic_string<CharT, Traits, A>> {
+    static void write(std::ostream &out, const std::basic_string<CharT, Traits, A> &value) {
+        serializer<uint64_t>::write(out, value.size());
+        out.write(reinterpret_cast<const char *>(value.data()), value.size() * sizeof(CharT));
+    }
+
+    static std::basic_string<CharT, Traits, A> read(std::istream &in) {
+        std::basic_string<CharT, Traits, A> value(serializer<uint64_t>::read(in), CharT());
+        in.read(reinterpret_cast<char *>(&value[0]), value.size() * sizeof(CharT));
+        return value;
+    }
+};
+
+/**
+ *  Iterators are views into the owning table: the slot array, its control
+ *  bytes and a position. Building or copying one never allocates.
+ *  While an incremental resize is in progress the iterator also knows the
+ *  table being drained and continues there after the current one.
+ */
+template<typename ValueType>
+class hash_map_iterator {
+private:
+    ValueType *p = nullptr;
+    const ctrl_t *ctrl = nullptr;
+    std::size_t capacity = 0;
+    std::size_t hash_index = 0;
+    ValueType *next_p = nullptr;
+    const ctrl_t *next_ctrl = nullptr;
+    std::size_t next_capacity = 0;
+
+    void settle() {
+        if (hash_index == capacity && next_ctrl != nullptr) {
+            p = next_p;
+            ctrl = next_ctrl;
+            capacity = next_capacity;
+            hash_index = next_full_slot(ctrl, capacity, 0);
+            next_p = nullptr;
+            next_ctrl = nullptr;
+            next_capacity = 0;
+        }
+    }
+
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = ValueType;
+    using difference_type = std::ptrdiff_t;
+    using reference = ValueType &;
+    using pointer = ValueType *;
+
+    template<typename K, typename T,
+            typename Hash,
+            typename Pred,
+            typename Alloc,
+            typename Policy>
+    friend
+    class hash_map;
+
+    template<typename>
+    friend
+    class hash_map_const_iterator;
+
+    hash_map_iterator() noexcept = default;
+
+    hash_map_iterator(pointer p, const ctrl_t *ctrl, std::size_t capacity, std::size_t hash_index,
+                      pointer next_p = nullptr, const ctrl_t *next_ctrl = nullptr,
+                      std::size_t next_capacity = 0) noexcept:
+            p(p), ctrl(ctrl),
+            capacity(capacity),
+            hash_index(hash_index),
+            next_p(next_p), next_ctrl(next_ctrl),
+            next_capacity(next_capacity) {}
+
+    hash_map_iterator(const hash_map_iterator &other) noexcept = default;
+
+    hash_map_iterator &operator=(const hash_map_iterator &other) noexcept = default;
+
+    reference operator*() const {
+        return *(p + hash_index);
+    }
+
+    pointer operator->() const {
+        return p + hash_index;
+    }
+
+    // prefix ++
+    hash_map_iterator &operator++() {
+        hash_index = next_full_slot(ctrl, capacity, hash_index + 1);
+        settle();
+        return *this;
+    }
+
+    // postfix ++
+    hash_map_iterator operator++(int) {
+        auto tmp = hash_map_iterator(*this);
+        operator++();
+        return tmp;
+    }
+
+    friend bool operator==(const hash_map_iterator<ValueType> &lhs, const hash_map_iterator<ValueType> &rhs) {
+        return (lhs.p + lhs.hash_index == rhs.p + rhs.hash_index);
+    }
+
+    friend bool operator!=(const hash_map_iterator<ValueType> &lhs, const hash_map_iterator<ValueType> &rhs) {
+        return !(lhs == rhs);
+    }
+};
+
+template<typename ValueType>
+class hash_map_const_iterator {
+private:
+    const ValueType *p = nullptr;
+    const ctrl_t *ctrl = nullptr;
+    std::size_t capacity = 0;
+    std::size_t hash_index = 0;
+    const ValueType *next_p = nullptr;
+    const ctrl_t *next_ctrl = nullptr;
+    std::size_t next_capacity = 0;
+
+    void settle() {
+        if (hash_index == capacity && next_ctrl != nullptr) {
+            p = next_p;
+            ctrl = next_ctrl;
+            capacity = next_capacity;
+            hash_index = next_full_slot(ctrl, capacity, 0);
+            next_p = nullptr;
+            next_ctrl = nullptr;
+            next_capacity = 0;
+        }
+    }
+
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = ValueType;
+    using difference_type = std::ptrdiff_t;
+    using reference = const ValueType &;
+    using pointer = const ValueType *;
+
+    template<typename K, typename T,
+            typename Hash,
+            typename Pred,
+            typename Alloc,
+            typename Policy>
+    friend
+    class hash_map;
+
+    hash_map_const_iterator() noexcept = default;
+
+    hash_map_const_iterator(pointer p, const ctrl_t *ctrl, std::size_t capacity, std::size_t hash_index,
+                            pointer next_p = nullptr, const ctrl_t *next_ctrl = nullptr,
+                            std::size_t next_capacity = 0) noexcept:
+            p(p), ctrl(ctrl),
+            capacity(capacity),
+            hash_index(hash_index),
+            next_p(next_p), next_ctrl(next_ctrl),
+            next_capacity(next_capacity) {}
+
+    hash_map_const_iterator(const hash_map_const_iterator &other) noexcept = default;
+
+    hash_map_const_iterator(const hash_map_iterator<ValueType> &other) noexcept:
+            p(other.p), ctrl(other.ctrl),
+            capacity(other.capacity),
+            hash_index(other.hash_index),
+            next_p(other.next_p), next_ctrl(other.next_ctrl),
+            next_capacity(other.next_capacity) {}
+
+    hash_map_const_iterator &operator=(const hash_map_const_iterator &other) noexcept = default;
+
+    reference operator*() const {
+        return *(p + hash_index);
+    }
+
+    pointer operator->() const {
+        return (p + hash_index);
+    }
+
+    // prefix ++
+    hash_map_const_iterator &operator++() {
+        hash_index = next_full_slot(ctrl, capacity, hash_index + 1);
+        settle();
+        return *this;
+    }
+
+    // postfix ++
+    hash_map_const_iterator operator++(int) {
+        auto tmp = hash_map_const_iterator(*this);
+        operator++();
+        return tmp;
+    }
+
+    friend bool operator==(const hash_map_const_iterator<ValueType> &lhs,
+                           const hash_map_const_iterator<ValueType> &rhs) {
+        return lhs.p + lhs.hash_index == rhs.p + rhs.hash_index;
+    }
+
+    friend bool operator!=(const hash_map_const_iterator<ValueType> &lhs,
+                           const hash_map_const_iterator<ValueType> &rhs) {
+        return !(lhs == rhs);
+    }
+};
+
+template<typename K, typename T, typename Hash, typename Pred, typename Alloc, typename Policy>
+class hash_map {
+private:
+    using key_type = K;
+    using mapped_type = T;
+    using hasher = Hash;
+    using key_equal = Pred;
+    using allocator_type = Alloc;
+    using value_type = std::pair<const key_type, mapped_type>;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+    using iterator = hash_map_iterator<value_type>;
+    using const_iterator = hash_map_const_iterator<value_type>;
+    using size_type = std::size_t;
+
+    using bucket_index = typename Policy::bucket_index;
+
+    /// Key, when Hash and Pred both accept keys other than key_type.
+    template<typename Key>
+    using transparent_key = typename std::enable_if<is_transparent<Hash>::value && is_transparent<Pred>::value,
+            Key>::type;
+
+    float loadfactor = 0, max_loadfactor = Policy::max_load_factor;
+    size_type current_size = 0, capacity = 0;
+    /// DELETED slots in the current table. They count against max_loadfactor
+    /// like elements do, because probes have to walk past them.
+    size_type tombstones = 0;
+    /// Set by an insert that probed Policy::max_probe_length slots or more.
+    bool long_probe = false;
+    value_type *arr = nullptr;
+    /// Control bytes come from the same allocator as the slots.
+    using ctrl_vector = std::vector<ctrl_t, typename std::allocator_traits<Alloc>::template rebind_alloc<ctrl_t>>;
+
+    /// capacity control bytes followed by a copy of the first ctrl_group::width
+    /// of them, so a group load starting near the end wraps around for free.
+    ctrl_vector status_ptr;
+
+    /// Table being drained into arr while an incremental resize is in progress.
+    struct old_table {
+        value_type *arr = nullptr;
+        ctrl_vector status;
+        size_type capacity = 0;
+        /// Slots below this index have been moved to the new table.
+        size_type migrated = 0;
+    } old_;
+
+    allocator_type allocator_;
+    hasher hasher_;
+    key_equal equal_;
+
+    struct stats_counters {
+        std::array<uint64_t, hash_map_stats::histogram_size> hit_probes{}, miss_probes{};
+        uint64_t rehashes = 0;
+        std::chrono::nanoseconds rehash_time{0};
+    };
+
+    struct no_stats_counters {
+    };
+
+    /// Bumped by const lookups too, so a map that collects stats must not be
+    /// read from several threads at once.
+    mutable typename std::conditional<Policy::collect_stats, stats_counters, no_stats_counters>::type counters_;
+
+    /// Not swapped: it traces this object whatever table it holds.
+    mutable typename Policy::tracer tracer_;
+public:
+    /// Default constructor.
+    hash_map() = default;
+
+    /**
+     *  @brief  Default constructor creates no elements.
+     *  @param n  Minimal initial number of buckets.
+     */
+    explicit hash_map(size_type n, const allocator_type &a = allocator_type()) :
+            status_ptr(typename ctrl_vector::allocator_type(a)), allocator_(a) {
+        capacity = bucket_index::capacity_for(n);
+        if (capacity != 0) {
+            status_ptr.assign(capacity + ctrl_group::width, EMPTY);
+            arr = allocator_.allocate(capacity);
+        }
+    }
+
+    ~hash_map() {
+        for (size_type i = 0; i < capacity; ++i) {
+            if (is_full(status_ptr[i]))
+                arr[i].~value_type();
+        }
+        if (arr != nullptr)
+            allocator_.deallocate(arr, capacity);
+        release_old_table();
+    }
+
+    /// Random-access ranges are built with bulk_insert, keeping the first
+    /// occurrence of a key like insert does.
+    template<typename InputIterator>
+    hash_map(InputIterator first, InputIterator last, size_type n = 0) : hash_map(n) {
+        insert_range(first, last, typename std::iterator_traits<InputIterator>::iterator_category());
+    }
+
+
+    /// Copy constructor.
+    hash_map(const hash_map &other) : hash_map(other.capacity, other.allocator_) {
+        max_loadfactor = other.max_loadfactor;
+        for (auto it = other.begin(); it != other.end(); ++it) {
+            insert(*it);
+        }
+    }
+
+    /// Move constructor.
+    hash_map(hash_map &&other) noexcept {
+        swap(other);
+    }
+
+    explicit hash_map(const allocator_type &a) : hash_map(0, a) {}
+
+    hash_map(std::initializer_list<value_type> l, size_type n = 0) : hash_map(n) {
+        for (auto it = l.begin(); it != l.end(); ++it) {
+            insert(*it);
+        }
+    }
+
+    /// Copy assignment operator.
+    hash_map &operator=(const hash_map &other) {
+        hash_map(other).swap(*this);
+        return *this;
+    }
+
+    /// Move assignment operator.
+    hash_map &operator=(hash_map &&other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    hash_map &operator=(std::initializer_list<value_type> l) {
+        for (auto it = l.begin(); it != l.end(); ++it) {
+            insert(*it);
+        }
+        return *this;
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_;
+    }
+
+    bool empty() const noexcept {
+        return current_size == 0;
+    }
+
+    size_type size() const noexcept {
+        return current_size;
+    }
+
+    size_type max_size() const noexcept {
+        return std::numeric_limits<size_type>::max();
+    }
+
+    void swap(hash_map &x) {
+        std::swap(arr, x.arr);
+        std::swap(allocator_, x.allocator_);
+        std::swap(capacity, x.capacity);
+        std::swap(loadfactor, x.loadfactor);
+        std::swap(max_loadfactor, x.max_loadfactor);
+        std::swap(hasher_, x.hasher_);
+        std::swap(status_ptr, x.status_ptr);
+        std::swap(old_, x.old_);
+        std::swap(current_size, x.current_size);
+        std::swap(tombstones, x.tombstones);
+        std::swap(long_probe, x.long_probe);
+        std::swap(equal_, x.equal_);
+        std::swap(counters_, x.counters_);
+    }
+
+    iterator begin() noexcept {
+        iterator it = make_iterator<iterator>(next_full_slot(status_ptr.data(), capacity, 0));
+        it.settle();
+        return it;
+    }
+
+    const_iterator begin() const noexcept {
+        return cbegin();
+    }
+
+    const_iterator cbegin() const noexcept {
+        const_iterator it = make_iterator<const_iterator>(next_full_slot(status_ptr.data(), capacity, 0));
+        it.settle();
+        return it;
+    }
+    float load_factor() const noexcept {
+        return capacity == 0 ? 0 : static_cast<float>(current_size) / capacity;
+    }
+
+    float max_load_factor() const noexcept {
+        return max_loadfactor;
+    }
+
+    /**
+     *  @brief  Sets the load, tombstones included, at which inserts grow the
+     *          table. A table already above it grows right away.
+     *  @throw  std::invalid_argument unless 0 < @a ml < 1: probes need an
+     *          EMPTY slot to stop at.
+     */
+    void max_load_factor(float ml) {
+        if (!(ml > 0 && ml < 1))
+            throw std::invalid_argument("max_load_factor must be in (0, 1)");
+        max_loadfactor = ml;
+        if (capacity != 0 && static_cast<float>(current_size) / capacity > ml)
+            reserve(current_size);
+    }
+
+
+
+    iterator end() noexcept {
+        return end_iterator<iterator>();
+    }
+
+    const_iterator end() const noexcept {
+        return cend();
+    }
+
+    const_iterator cend() const noexcept {
+        return end_iterator<const_iterator>();
+    }
+    size_type bucket_count() const noexcept {
+        return capacity;
+    }
+
+    std::pair<iterator, bool> insert(K key, T value) {
+        return emplace_unique(key, std::move(key), std::move(value));
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) {
+        return emplace_unique(value.first, value);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&value) {
+        return emplace_unique(value.first, std::move(value));
+    }
+
+    /**
+     *  @brief  Constructs the element from @a args if its key is absent.
+     *
+     *  A (key, mapped) argument pair is probed by the key and constructed in
+     *  place; any other argument list is first built into a value_type.
+     */
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        value_type value(std::forward<Args>(args)...);
+        return emplace_unique(value.first, std::move(value));
+    }
+
+    template<typename KeyArg, typename M,
+            typename = typename std::enable_if<std::is_same<typename std::decay<KeyArg>::type, key_type>::value>::type>
+    std::pair<iterator, bool> emplace(KeyArg &&key, M &&obj) {
+        return emplace_unique(key, std::forward<KeyArg>(key), std::forward<M>(obj));
+    }
+
+    /// Constructs mapped_type from @a args only if @a key is absent; otherwise
+    /// neither the key nor the arguments are touched.
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const key_type &key, Args &&... args) {
+        return emplace_unique(key, std::piecewise_construct, std::forward_as_tuple(key),
+                              std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(key_type &&key, Args &&... args) {
+        return emplace_unique(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                              std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&obj) {
+        auto res = try_emplace(key, std::forward<M>(obj));
+        if (!res.second)
+            res.first->second = std::forward<M>(obj);
+        return res;
+    }
+
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(key_type &&key, M &&obj) {
+        auto res = try_emplace(std::move(key), std::forward<M>(obj));
+        if (!res.second)
+            res.first->second = std::forward<M>(obj);
+        return res;
+    }
+
+    void erase(const key_type &key) {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::erase);
+        migrate_step();
+        erase_at(locate<iterator>(key, hash_of(key)));
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    void erase(const Key &key) {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::erase);
+        migrate_step();
+        erase_at(locate<iterator>(key, hash_of(key)));
+    }
+
+    void clear() noexcept {
+        for (size_type i = 0; i < capacity; ++i) {
+            if (is_full(status_ptr[i]))
+                arr[i].~value_type();
+        }
+        std::fill(status_ptr.begin(), status_ptr.end(), EMPTY);
+        release_old_table();
+        current_size = 0;
+        tombstones = 0;
+        long_probe = false;
+        loadfactor = 0;
+        if (Policy::shrink_load_factor > 0 && arr != nullptr) {
+            allocator_.deallocate(arr, capacity);
+            arr = nullptr;
+            capacity = 0;
+            ctrl_vector(status_ptr.get_allocator()).swap(status_ptr);
+        }
+    }
+
+    Hash hash_function() const {
+        return hasher_;
+    }
+
+    Pred key_eq() const {
+        return equal_;
+    }
+
+    /// Also advances an incremental resize, which invalidates iterators.
+    iterator find(const key_type &key) {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::find);
+        migrate_step();
+        return locate<iterator>(key, hash_of(key));
+    }
+
+    const_iterator find(const key_type &key) const {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::find);
+        return locate<const_iterator>(key, hash_of(key));
+    }
+
+    /// Heterogeneous lookup, available when both Hash and Pred are transparent.
+    template<typename Key, typename = transparent_key<Key>>
+    iterator find(const Key &key) {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::find);
+        migrate_step();
+        return locate<iterator>(key, hash_of(key));
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    const_iterator find(const Key &key) const {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::find);
+        return locate<const_iterator>(key, hash_of(key));
+    }
+
+    bool contains(const key_type &key) const {
+        return find(key) != end();
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    bool contains(const Key &key) const {
+        return find(key) != end();
+    }
+
+    size_type count(const key_type &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    size_type count(const Key &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    std::pair<iterator, iterator> equal_range(const key_type &key) {
+        return range_of(find(key));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const {
+        return range_of(find(key));
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    std::pair<iterator, iterator> equal_range(const Key &key) {
+        return range_of(find(key));
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    std::pair<const_iterator, const_iterator> equal_range(const Key &key) const {
+        return range_of(find(key));
+    }
+
+    /**
+     *  @brief  Looks up @a n keys at once, storing the iterator for keys[i]
+     *          (end() when absent) in results[i].
+     *
+     *  Keys are hashed and their first group and slot prefetched a batch at a
+     *  time before any probe runs, so the cache misses of a batch overlap.
+     */
+    void find_many(const key_type *keys, size_type n, iterator *results) {
+        migrate_step();
+        batch_lookup(keys, n, [this, results](size_type i, const key_type &key, size_t hash) {
+            results[i] = locate<iterator>(key, hash);
+        });
+    }
+
+    void find_many(const key_type *keys, size_type n, const_iterator *results) const {
+        batch_lookup(keys, n, [this, results](size_type i, const key_type &key, size_t hash) {
+            results[i] = locate<const_iterator>(key, hash);
+        });
+    }
+
+    /// Sets bit i % 64 of bits[i / 64] when keys[i] is present and clears it otherwise.
+    void contains_many(const key_type *keys, size_type n, uint64_t *bits) const {
+        std::fill(bits, bits + (n + 63) / 64, 0);
+        const_iterator last = end();
+        batch_lookup(keys, n, [this, bits, &last](size_type i, const key_type &key, size_t hash) {
+            if (locate<const_iterator>(key, hash) != last)
+                bits[i / 64] |= uint64_t(1) << (i % 64);
+        });
+    }
+
+    /// Rebuilds the whole table at once, finishing any incremental resize first.
+    /// Never shrinks the table; see shrink_to_fit().
+    void rehash(size_type n) {
+        auto started = stats_clock_now();
+        migrate(old_.capacity);
+        if (n >= capacity)
+            rebuild(n);
+        add_rehash_time(started);
+    }
+
+    /**
+     *  @brief  Moves the elements into the smallest table that holds them
+     *          within max_loadfactor. An empty map frees its table entirely.
+     */
+    void shrink_to_fit() {
+        auto started = stats_clock_now();
+        migrate(old_.capacity);
+        size_type n = current_size == 0 ? 0 : bucket_index::capacity_for(
+                std::max(min_capacity, static_cast<size_type>(std::ceil(current_size / max_loadfactor))));
+        if (n < capacity)
+            rebuild(n);
+        add_rehash_time(started);
+    }
+
+    template<typename _H2, typename _P2>
+    void merge(hash_map<K, T, _H2, _P2, Alloc, Policy>& source) {
+        for (auto it = source.begin(); it != source.end(); ++it)
+            insert(it->first, it->second);
+    }
+
+    template<typename _H2, typename _P2>
+    void merge(hash_map<K, T, _H2, _P2, Alloc, Policy>&& source) {
+        for (auto it = source.begin(); it != source.end(); ++it)
+            insert(it->first, it->second);
+    }
+
+
+    mapped_type& operator[](const key_type& k) {
+        auto res = try_emplace(k);
+        return res.first->second;
+    }
+
+    mapped_type& operator[](key_type&& k) {
+        auto res = try_emplace(std::move(k));
+        return res.first->second;
+    }
+
+    mapped_type& at(const key_type& k){
+        iterator iter = find(k);
+        if(iter == end()) {
+            throw std::out_of_range("item not found");
+        }
+        return (iter->second);
+    }
+
+
+    const mapped_type& at(const key_type& k) const{
+        const_iterator iter = find(k);
+        if(iter == end()) {
+            throw std::out_of_range("item not found");
+        }
+        return (iter->second);
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    mapped_type& at(const Key& k){
+        iterator iter = find(k);
+        if(iter == end()) {
+            throw std::out_of_range("item not found");
+        }
+        return (iter->second);
+    }
+
+    template<typename Key, typename = transparent_key<Key>>
+    const mapped_type& at(const Key& k) const{
+        const_iterator iter = find(k);
+        if(iter == end()) {
+            throw std::out_of_range("item not found");
+        }
+        return (iter->second);
+    }
+
+    void reserve(size_type n) {
+        rehash(ceil(n / max_loadfactor));
+    }
+
+    /// Counters plus a scan of the control bytes for clusters.
+    /// Only available with a Policy whose collect_stats is true.
+    template<bool Enabled = Policy::collect_stats>
+    hash_map_stats stats() const {
+        static_assert(Enabled, "derive the Policy from stats_policy to collect stats");
+        hash_map_stats s;
+        s.hit_probes = counters_.hit_probes;
+        s.miss_probes = counters_.miss_probes;
+        s.rehashes = counters_.rehashes;
+        s.rehash_time = counters_.rehash_time;
+        s.size = current_size;
+        s.capacity = capacity;
+        s.tombstones = tombstones;
+        s.max_cluster = longest_cluster();
+        s.bytes_allocated = capacity * sizeof(value_type) + status_ptr.capacity() * sizeof(ctrl_t) +
+                            old_.capacity * sizeof(value_type) + old_.status.capacity() * sizeof(ctrl_t);
+        if (old_.capacity != 0)
+            s.tombstones += std::count(old_.status.begin(), old_.status.begin() + old_.capacity, ctrl_t(DELETED));
+        return s;
+    }
+
+    /// The Policy's tracer, to read its histograms or name the table.
+    typename Policy::tracer &tracer() const noexcept {
+        return tracer_;
+    }
+
+    /// Zeroes the probe histograms and the rehash count and time.
+    template<bool Enabled = Policy::collect_stats>
+    void reset_stats() {
+        static_assert(Enabled, "derive the Policy from stats_policy to collect stats");
+        counters_ = stats_counters();
+    }
+
+    /**
+     *  @brief  Inserts a random-access range of pairs; @a combine(existing,
+     *          incoming) settles repeated keys (keep_first, keep_last or any
+     *          merge function).
+     *
+     *  Into an empty table this runs on @a threads threads (0 means one per
+     *  core): hashes are computed in parallel, the elements are partitioned
+     *  by the region of the table their home slot falls in, and every thread
+     *  fills its own region in input order. The few elements that would
+     *  probe past the end of their region are inserted afterwards. Each
+     *  thread merges with its own copy of @a combine, so a stateful Combine
+     *  must be copyable and must not share mutable state between copies;
+     *  the spilled elements use @a combine itself. Robin Hood
+     *  tables, tables that are not empty, and allocators other than a
+     *  default-constructed one (whose construct may not be thread-safe) take
+     *  the sequential path.
+     */
+    template<typename RandomIt, typename Combine = keep_first>
+    void bulk_insert(RandomIt first, RandomIt last, Combine combine = Combine(), unsigned threads = 0) {
+        const size_type n = static_cast<size_type>(last - first);
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (n < bulk_parallel_threshold)
+            threads = 1;
+        if (robin_hood || current_size != 0 || old_.capacity != 0 || !(allocator_ == allocator_type()) ||
+            threads == 1) {
+            reserve(current_size + n);
+            for (auto it = first; it != last; ++it)
+                insert_or_combine(*it, combine);
+            return;
+        }
+
+        reserve(n);
+        const size_type region = (capacity + threads - 1) / threads;
+        std::vector<size_t> hashes(n);
+        std::vector<size_type> order(n);
+        std::vector<std::vector<size_type>> offsets(threads, std::vector<size_type>(threads));
+        auto chunk_begin = [n, threads](unsigned t) {
+            return static_cast<size_type>(static_cast<uint64_t>(n) * t / threads);
+        };
+
+        run_parallel(threads, [&](unsigned t) {
+            for (size_type i = chunk_begin(t); i < chunk_begin(t + 1); ++i) {
+                hashes[i] = hash_of((*(first + i)).first);
+                ++offsets[t][home(hashes[i], capacity) / region];
+            }
+        });
+        // offsets[t][p]: where chunk t starts writing partition p, keeping input order.
+        std::vector<size_type> partition_begin(threads + 1);
+        size_type total = 0;
+        for (unsigned p = 0; p < threads; ++p) {
+            partition_begin[p] = total;
+            for (unsigned t = 0; t < threads; ++t) {
+                size_type count = offsets[t][p];
+                offsets[t][p] = total;
+                total += count;
+            }
+        }
+        partition_begin[threads] = total;
+        run_parallel(threads, [&](unsigned t) {
+            for (size_type i = chunk_begin(t); i < chunk_begin(t + 1); ++i)
+                order[offsets[t][home(hashes[i], capacity) / region]++] = i;
+        });
+
+        std::vector<std::vector<size_type>> overflow(threads);
+        std::vector<size_type> inserted(threads);
+        try {
+            run_parallel(threads, [&](unsigned p) {
+                const size_type end = std::min(capacity, (p + 1) * region);
+                Combine merge = combine;
+                for (size_type k = partition_begin[p]; k < partition_begin[p + 1]; ++k) {
+                    size_type i = order[k];
+                    int placed = place_in_region(*(first + i), hashes[i], end, merge);
+                    if (placed < 0)
+                        overflow[p].push_back(i);
+                    else
+                        inserted[p] += placed;
+                }
+            });
+        } catch (...) {
+            for (size_type count : inserted)
+                current_size += count;
+            loadfactor = static_cast<float>(current_size) / capacity;
+            throw;
+        }
+        for (size_type count : inserted)
+            current_size += count;
+        loadfactor = static_cast<float>(current_size) / capacity;
+        for (const auto &spilled : overflow) {
+            for (size_type i : spilled)
+                insert_or_combine(*(first + i), combine);
+        }
+    }
+
+    /**
+     *  @brief  Writes the map to @a out in native byte order.
+     *
+     *  When K and T are trivially copyable the control bytes and the slot
+     *  array are written as two raw blocks; otherwise each pair goes through
+     *  serializer<K> and serializer<T>.
+     */
+    void save(std::ostream &out) const {
+        snapshot_header h{};
+        std::memcpy(h.magic, snapshot_magic, sizeof(h.magic));
+        h.version = snapshot_version;
+        h.flags = (raw_snapshots && old_.capacity == 0 ? snapshot_raw : 0u) | (robin_hood ? snapshot_robin_hood : 0u);
+        h.key_size = sizeof(K);
+        h.mapped_size = sizeof(T);
+        h.value_size = sizeof(value_type);
+        h.group_width = ctrl_group::width;
+        h.capacity = capacity;
+        h.size = current_size;
+        h.fingerprint = fingerprint();
+        out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        if (h.flags & snapshot_raw) {
+            if (capacity != 0) {
+                out.write(reinterpret_cast<const char *>(status_ptr.data()), status_ptr.size());
+                out.write(reinterpret_cast<const char *>(arr), capacity * sizeof(value_type));
+            }
+        } else {
+            for (auto it = begin(); it != end(); ++it) {
+                serializer<K>::write(out, it->first);
+                serializer<T>::write(out, it->second);
+            }
+        }
+        if (!out)
+            throw std::runtime_error("cannot write hash_map snapshot");
+    }
+
+    /**
+     *  @brief  Replaces the contents with a snapshot written by save().
+     *
+     *  A raw snapshot is read straight into a table of the saved size and
+     *  used as is when its layout matches this build and the saved keys still
+     *  hash to the recorded fingerprint; otherwise its elements are inserted
+     *  again, as are those of a per-element snapshot, into a presized table.
+     */
+    void load(std::istream &in) {
+        snapshot_header h{};
+        in.read(reinterpret_cast<char *>(&h), sizeof(h));
+        if (!in || std::memcmp(h.magic, snapshot_magic, sizeof(h.magic)) != 0 || h.version != snapshot_version)
+            throw std::runtime_error("not a hash_map snapshot");
+        hash_map loaded(0, allocator_);
+        loaded.hasher_ = hasher_;
+        loaded.equal_ = equal_;
+        loaded.max_loadfactor = max_loadfactor;
+        if (h.flags & snapshot_raw) {
+            if (!raw_snapshots || h.key_size != sizeof(K) || h.mapped_size != sizeof(T) ||
+                h.value_size != sizeof(value_type))
+                throw std::runtime_error("hash_map snapshot holds other key or value types");
+            hash_map saved(0, allocator_);
+            saved.hasher_ = hasher_;
+            if (h.capacity != 0) {
+                saved.arr = saved.allocator_.allocate(h.capacity);
+                saved.capacity = h.capacity;
+                saved.status_ptr.resize(h.capacity + h.group_width);
+                in.read(reinterpret_cast<char *>(saved.status_ptr.data()), saved.status_ptr.size());
+                if (!in) {
+                    std::fill(saved.status_ptr.begin(), saved.status_ptr.end(), EMPTY);
+                    throw std::runtime_error("truncated hash_map snapshot");
+                }
+                in.read(reinterpret_cast<char *>(saved.arr), h.capacity * sizeof(value_type));
+                if (!in) {
+                    std::fill(saved.status_ptr.begin(), saved.status_ptr.end(), EMPTY);
+                    throw std::runtime_error("truncated hash_map snapshot");
+                }
+            }
+            saved.current_size = h.size;
+            bool same_layout = h.group_width == ctrl_group::width &&
+                               ((h.flags & snapshot_robin_hood) != 0) == robin_hood &&
+                               bucket_index::capacity_for(h.capacity) == h.capacity &&
+                               saved.fingerprint() == h.fingerprint;
+            if (same_layout) {
+                saved.loadfactor = h.capacity == 0 ? 0 : static_cast<float>(h.size) / h.capacity;
+                saved.tombstones = std::count(saved.status_ptr.begin(), saved.status_ptr.begin() + h.capacity,
+                                              ctrl_t(DELETED));
+                saved.equal_ = equal_;
+                saved.max_loadfactor = max_loadfactor;
+                swap(saved);
+                return;
+            }
+            loaded.reserve(h.size);
+            for (size_type i = 0; i < saved.capacity; ++i) {
+                if (is_full(saved.status_ptr[i]))
+                    loaded.emplace_unique(saved.arr[i].first, saved.arr[i]);
+            }
+        } else {
+            loaded.reserve(h.size);
+            for (uint64_t i = 0; i < h.size; ++i) {
+                K key = serializer<K>::read(in);
+                T value = serializer<T>::read(in);
+                if (!in)
+                    throw std::runtime_error("truncated hash_map snapshot");
+                loaded.emplace_unique(key, std::move(key), std::move(value));
+            }
+        }
+        swap(loaded);
+    }
+
+private:
+    /// Ranges shorter than this are not worth starting threads for.
+    static constexpr size_type bulk_parallel_threshold = 1 << 16;
+
+    template<typename InputIterator>
+    void insert_range(InputIterator first, InputIterator last, std::input_iterator_tag) {
+        for (auto it = first; it != last; ++it)
+            insert(*it);
+    }
+
+    template<typename RandomIt>
+    void insert_range(RandomIt first, RandomIt last, std::random_access_iterator_tag) {
+        bulk_insert(first, last);
+    }
+
+    template<typename Pair, typename Combine>
+    void insert_or_combine(const Pair &value, Combine &combine) {
+        auto result = emplace_unique(value.first, value);
+        if (!result.second)
+            combine(result.first->second, value.second);
+    }
+
+    /// Runs f(0) .. f(threads - 1), f(0) on the calling thread, and rethrows
+    /// the first exception once all have finished.
+    template<typename F>
+    static void run_parallel(unsigned threads, F f) {
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t) {
+            workers.emplace_back([&f, &errors, t] {
+                try {
+                    f(t);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        try {
+            f(0);
+        } catch (...) {
+            errors[0] = std::current_exception();
+        }
+        for (std::thread &worker : workers)
+            worker.join();
+        for (const std::exception_ptr &error : errors) {
+            if (error)
+                std::rethrow_exception(error);
+        }
+    }
+
+    /**
+     *  Linear probe from the home slot of @a value up to @a end, one control
+     *  byte at a time so nothing outside the caller's region is read. Returns
+     *  1 if @a value was added, 0 if it met its key and was combined, -1 if
+     *  the region ran out first.
+     */
+    template<typename Pair, typename Combine>
+    int place_in_region(const Pair &value, size_t hash, size_type end, Combine &combine) {
+        const ctrl_t tag = h2(hash);
+        for (size_type pos = home(hash, capacity); pos < end; ++pos) {
+            if (status_ptr[pos] == EMPTY) {
+                std::allocator_traits<allocator_type>::construct(allocator_, arr + pos, value);
+                set_ctrl(pos, tag);
+                return 1;
+            }
+            if (status_ptr[pos] == tag && equal_(arr[pos].first, value.first)) {
+                combine(arr[pos].second, value.second);
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    static constexpr bool raw_snapshots = std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value;
+    static constexpr char snapshot_magic[8] = {'H', 'M', 'S', 'N', 'A', 'P', '\0', '\0'};
+    static constexpr uint32_t snapshot_version = 1, snapshot_raw = 1, snapshot_robin_hood = 2;
+
+    struct snapshot_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t key_size;
+        uint32_t mapped_size;
+        uint32_t value_size;
+        uint32_t group_width;
+        uint64_t capacity;
+        uint64_t size;
+        uint64_t fingerprint;
+    };
+
+    /// Mixes the positions and hashes of the first few elements; a raw
+    /// snapshot is reused only if the loading hasher reproduces it.
+    uint64_t fingerprint() const {
+        uint64_t h = capacity;
+        size_type seen = 0;
+        for (size_type i = 0; i < capacity && seen < 16; ++i) {
+            if (is_full(status_ptr[i])) {
+                h = mix_hash(h ^ i) ^ hash_of(arr[i].first);
+                ++seen;
+            }
+        }
+        return h;
+    }
+
+    static constexpr bool robin_hood = std::is_same<typename Policy::probing, robin_hood_probing>::value;
+
+    /// Largest probe distance a Robin Hood control byte stores directly.
+    static constexpr ctrl_t saturated_distance = 127;
+
+    /// Smallest table allocated by the first insert.
+    static constexpr size_type min_capacity = 8;
+
+    /// Hash used for probing: Hash's own result, mixed unless Hash avalanches.
+    template<typename Key>
+    size_t hash_of(const Key &key) const {
+        size_t hash = hasher_(key);
+        return is_avalanching<Hash>::value ? hash : mix_hash(hash);
+    }
+
+    static ctrl_t h2(size_t hash) {
+        return bucket_index::tag(hash);
+    }
+
+    static size_type home(size_t hash, size_type capacity) {
+        return bucket_index::index(hash, capacity);
+    }
+
+    /// Brings a probe position that ran past the end back into the table.
+    static size_type wrap(size_type i, size_type capacity) {
+        return i < capacity ? i : i % capacity;
+    }
+
+    static void set_ctrl(ctrl_vector &ctrl, size_type capacity, size_type i, ctrl_t c) {
+        ctrl[i] = c;
+        for (size_type j = i + capacity; j < capacity + ctrl_group::width; j += capacity)
+            ctrl[j] = c;
+    }
+
+    void set_ctrl(size_type i, ctrl_t c) {
+        set_ctrl(status_ptr, capacity, i, c);
+    }
+
+    /**
+     *  @brief  Probes one group at a time, comparing keys only in slots whose
+     *          control byte carries the same 7 hash bits.
+     *  @return  Slot of @a key, or @a capacity when it is absent.
+     */
+    template<typename Key>
+    size_type find_index(const value_type *slots, const ctrl_t *ctrl, size_type capacity,
+                         const Key &key, size_t hash) const {
+        if (capacity == 0)
+            return capacity;
+        if (robin_hood)
+            return robin_hood_find_index(slots, ctrl, capacity, key, hash);
+        ctrl_t tag = h2(hash);
+        size_type pos = home(hash, capacity), groups = 1;
+        for (size_type probed = 0; probed < capacity; probed += ctrl_group::width, ++groups) {
+            ctrl_group group(ctrl + pos);
+            for (uint32_t mask = group.match(tag); mask != 0; mask &= mask - 1) {
+                size_type i = wrap(pos + lowest_bit(mask), capacity);
+                if (equal_(slots[i].first, key)) {
+                    note_probe(true, groups);
+                    return i;
+                }
+            }
+            if (group.match_empty() != 0) {
+                note_probe(false, groups);
+                return capacity;
+            }
+            pos = wrap(pos + ctrl_group::width, capacity);
+        }
+        note_probe(false, groups - 1);
+        return capacity;
+    }
+
+    using stats_clock = std::chrono::steady_clock;
+
+    /// Stats hooks; each is empty unless Policy::collect_stats.
+    void note_probe(bool hit, size_type length) const {
+        if constexpr (Policy::collect_stats) {
+            size_type k = std::min<size_type>(63 - __builtin_clzll(static_cast<unsigned long long>(length)),
+                                              hash_map_stats::histogram_size - 1);
+            ++(hit ? counters_.hit_probes : counters_.miss_probes)[k];
+        }
+    }
+
+    static stats_clock::time_point stats_clock_now() {
+        if constexpr (Policy::collect_stats)
+            return stats_clock::now();
+        else
+            return stats_clock::time_point();
+    }
+
+    void add_rehash_time(stats_clock::time_point started) {
+        if constexpr (Policy::collect_stats)
+            counters_.rehash_time += stats_clock::now() - started;
+    }
+
+    void count_rehash() {
+        if constexpr (Policy::collect_stats)
+            ++counters_.rehashes;
+    }
+
+    /// Longest run of non-EMPTY control bytes, counting a run that wraps
+    /// from the end of the table to its start as one.
+    size_type longest_cluster() const {
+        size_type longest = 0, run = 0, leading = 0;
+        bool at_start = true;
+        for (size_type i = 0; i < capacity; ++i) {
+            if (status_ptr[i] == EMPTY) {
+                at_start = false;
+                run = 0;
+                continue;
+            }
+            ++run;
+            if (at_start)
+                leading = run;
+            longest = std::max(longest, run);
+        }
+        if (!at_start)
+            longest = std::max(longest, run + leading);
+        return longest;
+    }
+
+    template<typename Key>
+    size_type find_index(const Key &key, size_t hash) const {
+        return find_index(arr, status_ptr.data(), capacity, key, hash);
+    }
+
+    /// Iterator to slot @a i of the current table. It carries on into the
+    /// table being drained, if any, once it runs off the end.
+    template<typename Iter>
+    Iter make_iterator(size_type i) const {
+        return Iter(arr, status_ptr.data(), capacity, i, old_.arr, old_.status.data(), old_.capacity);
+    }
+
+    template<typename Iter>
+    Iter end_iterator() const {
+        if (old_.capacity != 0)
+            return Iter(old_.arr, old_.status.data(), old_.capacity, old_.capacity);
+        return Iter(arr, status_ptr.data(), capacity, capacity);
+    }
+
+    /// Looks @a key up in the current table, then in the one being drained.
+    template<typename Iter, typename Key>
+    Iter locate(const Key &key, size_t hash) const {
+        size_type index = find_index(key, hash);
+        if (index != capacity)
+            return make_iterator<Iter>(index);
+        if (old_.capacity != 0) {
+            index = find_index(old_.arr, old_.status.data(), old_.capacity, key, hash);
+            if (index != old_.capacity)
+                return Iter(old_.arr, old_.status.data(), old_.capacity, index);
+        }
+        return end_iterator<Iter>();
+    }
+
+    /**
+     *  @brief  Inserts value_type(args...) unless @a key is already present.
+     *
+     *  The probe runs before anything is constructed, so a hit costs no copy
+     *  and no allocation. @a key may alias one of @a args.
+     */
+    template<typename Key, typename... Args>
+    std::pair<iterator, bool> emplace_unique(const Key &key, Args &&... args) {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::insert);
+        migrate_step();
+        size_t hash = hash_of(key);
+        iterator found = locate<iterator>(key, hash);
+        if (found != end())
+            return std::pair<iterator, bool>(found, false);
+
+        if (capacity == 0) {
+            rehash(min_capacity);
+        } else if (static_cast<float>(current_size + tombstones + 1) / capacity > max_loadfactor ||
+                   (long_probe && static_cast<float>(current_size + 1) / capacity >= max_loadfactor / 2)) {
+            if (old_.capacity == 0 && tombstones != 0 &&
+                static_cast<float>(current_size + 1) / capacity <= max_loadfactor / 2)
+                drop_tombstones();
+            else
+                grow();
+        }
+        size_type index = prepare_insert(hash);
+        try {
+            std::allocator_traits<allocator_type>::construct(allocator_, arr + index, std::forward<Args>(args)...);
+        } catch (...) {
+            if (robin_hood) {
+                shift_back(index);
+            } else {
+                set_ctrl(index, DELETED);
+                ++tombstones;
+            }
+            throw;
+        }
+        current_size++;
+        loadfactor = static_cast<float>(current_size) / capacity;
+        return std::pair<iterator, bool>(make_iterator<iterator>(index), true);
+    }
+
+    /// Moves @a from into raw slot @a to and destroys it, key included. @a from
+    /// is never read again, so taking its const key is safe in practice; node
+    /// handles in the standard library do the same.
+    static void relocate(value_type *to, value_type &from) {
+        new(to) value_type(std::move(const_cast<key_type &>(from.first)), std::move(from.second));
+        from.~value_type();
+    }
+
+    void erase_at(iterator it) {
+        if (it == end()) {
+            std::cout << "There is no such element in the map" << std::endl;
+            return;
+        }
+        it->~value_type();
+        current_size--;
+        loadfactor = static_cast<float>(current_size) / capacity;
+        if (it.p != arr) {
+            set_ctrl(old_.status, old_.capacity, it.hash_index, DELETED);
+        } else if (robin_hood) {
+            shift_back(it.hash_index);
+        } else {
+            set_ctrl(it.hash_index, DELETED);
+            ++tombstones;
+        }
+        maybe_shrink();
+    }
+
+    template<typename Iter>
+    std::pair<Iter, Iter> range_of(Iter it) const {
+        if (it == end())
+            return std::pair<Iter, Iter>(it, it);
+        Iter next = it;
+        return std::pair<Iter, Iter>(it, ++next);
+    }
+
+    /// Keys hashed and prefetched ahead of the probes in find_many/contains_many.
+    static constexpr size_type lookup_batch = 16;
+
+    template<typename Resolve>
+    void batch_lookup(const key_type *keys, size_type n, Resolve resolve) const {
+        size_t hashes[lookup_batch];
+        for (size_type first = 0; first < n; first += lookup_batch) {
+            size_type count = std::min(lookup_batch, n - first);
+            for (size_type j = 0; j < count; ++j) {
+                hashes[j] = hash_of(keys[first + j]);
+                if (capacity != 0) {
+                    size_type pos = home(hashes[j], capacity);
+                    __builtin_prefetch(status_ptr.data() + pos);
+                    __builtin_prefetch(arr + pos);
+                }
+            }
+            for (size_type j = 0; j < count; ++j)
+                resolve(first + j, keys[first + j], hashes[j]);
+        }
+    }
+
+    /// Moves every element into a fresh table of @a n slots, which may be
+    /// smaller than the current one but must hold them all.
+    void rebuild(size_type n) {
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::rehash);
+        tracer_.rehash_begin(this, capacity, n);
+        hash_map temp(n, allocator_);
+        temp.hasher_ = hasher_;
+        temp.equal_ = equal_;
+        temp.max_loadfactor = max_loadfactor;
+        for (size_type i = 0; i < capacity; ++i) {
+            if (is_full(status_ptr[i])) {
+                relocate(temp.arr + temp.prepare_insert(hash_of(arr[i].first)), arr[i]);
+                status_ptr[i] = EMPTY;
+            }
+        }
+        temp.current_size = current_size;
+        temp.loadfactor = temp.capacity == 0 ? 0 : static_cast<float>(current_size) / temp.capacity;
+        current_size = 0;
+        std::swap(counters_, temp.counters_);
+        swap(temp);
+        count_rehash();
+        tracer_.rehash_end(this, capacity);
+    }
+
+    /// With Policy::shrink_load_factor, halves a table whose load has
+    /// dropped below it. Called after every erase.
+    void maybe_shrink() {
+        if (Policy::shrink_load_factor > 0 && old_.capacity == 0 && capacity > min_capacity &&
+            static_cast<float>(current_size) < Policy::shrink_load_factor * capacity) {
+            auto started = stats_clock_now();
+            rebuild(bucket_index::capacity_for(capacity / 2));
+            add_rehash_time(started);
+        }
+    }
+
+    /// Doubles the table: at once, or by parking the current table in old_
+    /// and draining it Policy::rehash_step slots per operation.
+    void grow() {
+        if (Policy::rehash_step == 0) {
+            rehash(capacity * 2);
+            return;
+        }
+        auto started = stats_clock_now();
+        count_rehash();
+        migrate(old_.capacity);
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::rehash);
+        tracer_.rehash_begin(this, capacity, capacity * 2);
+        old_.arr = arr;
+        old_.status = std::move(status_ptr);
+        old_.capacity = capacity;
+        old_.migrated = 0;
+        capacity = bucket_index::capacity_for(capacity * 2);
+        arr = allocator_.allocate(capacity);
+        status_ptr.assign(capacity + ctrl_group::width, EMPTY);
+        tombstones = 0;
+        long_probe = false;
+        loadfactor = static_cast<float>(current_size) / capacity;
+        add_rehash_time(started);
+    }
+
+    /**
+     *  @brief  Rehashes in place to clear out tombstones, for when at least
+     *          half of the load allowed by max_loadfactor is DELETED slots.
+     *
+     *  Every full slot is first marked DELETED, meaning "not yet placed", and
+     *  every DELETED one EMPTY. Each unplaced element then goes to the first
+     *  free slot on its probe sequence. It stays put if that slot is in the
+     *  group it already sits in, moves if the slot is EMPTY, and otherwise
+     *  trades places with the unplaced element there, which is handled next.
+     *  Only one element at a time is held outside the table.
+     */
+    void drop_tombstones() {
+        auto started = stats_clock_now();
+        [[maybe_unused]] auto traced = tracer_.trace(trace_op::rehash);
+        tracer_.rehash_begin(this, capacity, capacity);
+        for (size_type i = 0; i < capacity; ++i)
+            status_ptr[i] = is_full(status_ptr[i]) ? ctrl_t(DELETED) : ctrl_t(EMPTY);
+        for (size_type j = capacity; j < capacity + ctrl_group::width; ++j)
+            status_ptr[j] = status_ptr[j - capacity];
+
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type spare;
+        value_type *held = reinterpret_cast<value_type *>(&spare);
+        for (size_type i = 0; i < capacity; ++i) {
+            if (status_ptr[i] != DELETED)
+                continue;
+            size_t hash = hash_of(arr[i].first);
+            size_type start = home(hash, capacity);
+            size_type target = find_first_non_full(hash);
+            auto probe_group = [start, this](size_type slot) {
+                return (slot >= start ? slot - start : slot + capacity - start) / ctrl_group::width;
+            };
+            if (probe_group(target) == probe_group(i)) {
+                set_ctrl(i, h2(hash));
+                continue;
+            }
+            if (status_ptr[target] == EMPTY) {
+                relocate(arr + target, arr[i]);
+                set_ctrl(target, h2(hash));
+                set_ctrl(i, EMPTY);
+                continue;
+            }
+            relocate(held, arr[target]);
+            relocate(arr + target, arr[i]);
+            relocate(arr + i, *held);
+            set_ctrl(target, h2(hash));
+            --i;
+        }
+        tombstones = 0;
+        long_probe = false;
+        count_rehash();
+        add_rehash_time(started);
+        tracer_.rehash_end(this, capacity);
+    }
+
+    void migrate_step() {
+        if (Policy::rehash_step != 0 && old_.capacity != 0) {
+            auto started = stats_clock_now();
+            migrate(Policy::rehash_step);
+            add_rehash_time(started);
+        }
+    }
+
+    /// Moves the next @a slots slots of the old table into the current one.
+    /// Drained slots are marked DELETED so probes of the old table still pass them.
+    void migrate(size_type slots) {
+        if (old_.capacity == 0)
+            return;
+        size_type stop = std::min(old_.capacity, old_.migrated + slots);
+        for (; old_.migrated < stop; ++old_.migrated) {
+            size_type i = old_.migrated;
+            if (!is_full(old_.status[i]))
+                continue;
+            value_type &slot = old_.arr[i];
+            size_t hash = hash_of(slot.first);
+            relocate(arr + prepare_insert(hash), slot);
+            set_ctrl(old_.status, old_.capacity, i, DELETED);
+        }
+        if (old_.migrated == old_.capacity) {
+            release_old_table();
+            tracer_.rehash_end(this, capacity);
+        }
+    }
+
+    void release_old_table() {
+        if (old_.capacity == 0)
+            return;
+        for (size_type i = old_.migrated; i < old_.capacity; ++i) {
+            if (is_full(old_.status[i]))
+                old_.arr[i].~value_type();
+        }
+        allocator_.deallocate(old_.arr, old_.capacity);
+        old_ = old_table();
+    }
+
+    /// First EMPTY or DELETED slot on the probe sequence of @a hash.
+    size_type find_first_non_full(size_t hash) const {
+        size_type pos = home(hash, capacity);
+        while (true) {
+            ctrl_group group(status_ptr.data() + pos);
+            uint32_t mask = group.match_empty_or_deleted();
+            if (mask != 0)
+                return wrap(pos + lowest_bit(mask), capacity);
+            pos = wrap(pos + ctrl_group::width, capacity);
+        }
+    }
+
+    /// Claims a slot for an absent key with hash @a hash and sets its control
+    /// byte; the caller constructs the element in it.
+    size_type prepare_insert(size_t hash) {
+        if (robin_hood)
+            return robin_hood_prepare_insert(hash);
+        size_type index = find_first_non_full(hash);
+        if (status_ptr[index] == DELETED)
+            --tombstones;
+        note_insert_probe(hash, index);
+        set_ctrl(index, h2(hash));
+        return index;
+    }
+
+    /// Flags an insert for @a hash that walked to slot @a last as a long probe.
+    void note_insert_probe(size_t hash, size_type last) {
+        if (Policy::max_probe_length == 0)
+            return;
+        size_type start = home(hash, capacity);
+        if ((last >= start ? last - start : last + capacity - start) >= Policy::max_probe_length)
+            long_probe = true;
+    }
+
+    size_type next_slot(size_type i, size_type capacity) const {
+        return i + 1 == capacity ? 0 : i + 1;
+    }
+
+    /// Distance of slot @a i from its home slot, rehashing the key only when
+    /// the control byte has saturated.
+    size_type distance(const value_type *slots, const ctrl_t *ctrl, size_type capacity, size_type i) const {
+        if (ctrl[i] < saturated_distance)
+            return static_cast<size_type>(ctrl[i]);
+        size_type start = home(hash_of(slots[i].first), capacity);
+        return i >= start ? i - start : i + capacity - start;
+    }
+
+    static ctrl_t distance_ctrl(size_type distance) {
+        return static_cast<ctrl_t>(std::min<size_type>(distance, saturated_distance));
+    }
+
+    /**
+     *  Stops at the first empty slot or at the first element closer to its
+     *  home than @a key would be. DELETED only shows up in a table being
+     *  drained by an incremental resize and is stepped over.
+     */
+    template<typename Key>
+    size_type robin_hood_find_index(const value_type *slots, const ctrl_t *ctrl, size_type capacity,
+                                    const Key &key, size_t hash) const {
+        size_type pos = home(hash, capacity);
+        for (size_type dist = 0; dist < capacity; ++dist, pos = next_slot(pos, capacity)) {
+            ctrl_t c = ctrl[pos];
+            if (c == EMPTY) {
+                note_probe(false, dist + 1);
+                return capacity;
+            }
+            if (c == DELETED)
+                continue;
+            size_type d = distance(slots, ctrl, capacity, pos);
+            if (d < dist) {
+                note_probe(false, dist + 1);
+                return capacity;
+            }
+            if (d == dist && equal_(slots[pos].first, key)) {
+                note_probe(true, dist + 1);
+                return pos;
+            }
+        }
+        note_probe(false, capacity);
+        return capacity;
+    }
+
+    /// Takes the slot of the first richer element and shifts the rest of
+    /// the run one slot forward.
+    size_type robin_hood_prepare_insert(size_t hash) {
+        size_type pos = home(hash, capacity), dist = 0;
+        while (is_full(status_ptr[pos]) && distance(arr, status_ptr.data(), capacity, pos) >= dist) {
+            pos = next_slot(pos, capacity);
+            ++dist;
+        }
+        size_type empty = pos;
+        while (is_full(status_ptr[empty]))
+            empty = next_slot(empty, capacity);
+        note_insert_probe(hash, empty);
+        while (empty != pos) {
+            size_type prev = empty == 0 ? capacity - 1 : empty - 1;
+            ctrl_t c = status_ptr[prev];
+            relocate(arr + empty, arr[prev]);
+            set_ctrl(empty, c < saturated_distance ? static_cast<ctrl_t>(c + 1) : c);
+            empty = prev;
+        }
+        set_ctrl(pos, distance_ctrl(dist));
+        return pos;
+    }
+
+    /// Backward-shift deletion: pulls every following element of the run one
+    /// slot closer to home, so no tombstone is left behind.
+    void shift_back(size_type hole) {
+        size_type next = next_slot(hole, capacity);
+        while (is_full(status_ptr[next]) && status_ptr[next] > 0) {
+            size_type d = distance(arr, status_ptr.data(), capacity, next);
+            relocate(arr + hole, arr[next]);
+            set_ctrl(hole, distance_ctrl(d - 1));
+            hole = next;
+            next = next_slot(next, capacity);
+        }
+        set_ctrl(hole, EMPTY);
+    }
+
+};
+
+/**
+ *  @brief  Thread-safe map built from independent hash_map shards.
+ *
+ *  The shard is picked by the high bits of the mixed hash, so keys spread
+ *  over shards even when Hash is the identity. Each shard has its own
+ *  shared_mutex: lookups take it shared, updates take it exclusive. Results
+ *  are returned by value because iterators would outlive the lock.
+ */
+template<typename K, typename T,
+        typename Hash = std::hash<K>,
+        typename Pred = std::equal_to<K>,
+        typename Alloc = My_allocator<std::pair<const K, T>>>
+class concurrent_hash_map {
+public:
+    using key_type = K;
+    using mapped_type = T;
+    using size_type = std::size_t;
+    using shard_type = hash_map<K, T, Hash, Pred, Alloc>;
+
+    /**
+     *  @param shard_bits  log2 of the number of shards.
+     */
+    explicit concurrent_hash_map(unsigned shard_bits = 6) : shard_bits(shard_bits), shards(size_type(1) << shard_bits) {}
+
+    size_type shard_count() const noexcept {
+        return shards.size();
+    }
+
+    /// Copies the value of @a key into @a value; returns false when it is absent.
+    bool find(const key_type &key, mapped_type &value) const {
+        const shard &s = shard_for(key);
+        std::shared_lock<std::shared_mutex> lock(s.mutex);
+        auto it = s.map.find(key);
+        if (it == s.map.end())
+            return false;
+        value = it->second;
+        return true;
+    }
+
+    bool contains(const key_type &key) const {
+        const shard &s = shard_for(key);
+        std::shared_lock<std::shared_mutex> lock(s.mutex);
+        return s.map.find(key) != s.map.end();
+    }
+
+    /// Returns false and leaves the map unchanged when @a key is already present.
+    bool insert(const key_type &key, const mapped_type &value) {
+        shard &s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mutex);
+        return s.map.insert(key, value).second;
+    }
+
+    bool erase(const key_type &key) {
+        shard &s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mutex);
+        if (s.map.find(key) == s.map.end())
+            return false;
+        s.map.erase(key);
+        return true;
+    }
+
+    /**
+     *  @brief  Applies @a fn to the value of @a key under the shard's exclusive
+     *          lock, inserting a value-initialized mapped_type first if needed.
+     *  @return  true when the key was inserted.
+     */
+    template<typename F>
+    bool upsert(const key_type &key, F fn) {
+        shard &s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mutex);
+        auto res = s.map.insert(key, mapped_type());
+        fn(res.first->second);
+        return res.second;
+    }
+
+    size_type size() const {
+        size_type total = 0;
+        for (const shard &s : shards) {
+            std::shared_lock<std::shared_mutex> lock(s.mutex);
+            total += s.map.size();
+        }
+        return total;
+    }
+
+    /**
+     *  @brief  Calls fn(shard_index, const shard_type &) for every shard under
+     *          that shard's shared lock.
+     *  @param threads  Shards are split round-robin over this many threads.
+     */
+    template<typename F>
+    void for_each_shard(F fn, unsigned threads = 1) const {
+        auto visit = [this, &fn, threads](unsigned first) {
+            for (size_type i = first; i < shards.size(); i += threads) {
+                std::shared_lock<std::shared_mutex> lock(shards[i].mutex);
+                fn(i, static_cast<const shard_type &>(shards[i].map));
+            }
+        };
+        if (threads <= 1) {
+            visit(0);
+            return;
+        }
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; ++t)
+            pool.emplace_back(visit, t);
+        for (auto &thread : pool)
+            thread.join();
+    }
+
+private:
+    /// Padded to a cache line so neighbouring shards' locks do not false-share.
+    struct alignas(64) shard {
+        mutable std::shared_mutex mutex;
+        shard_type map;
+    };
+
+    unsigned shard_bits;
+    std::vector<shard> shards;
+    Hash hasher_;
+
+    size_type shard_index(const key_type &key) const {
+        if (shard_bits == 0)
+            return 0;
+        return static_cast<size_type>((static_cast<uint64_t>(hasher_(key)) * 0x9E3779B97F4A7C15ull) >> (64 - shard_bits));
+    }
+
+    shard &shard_for(const key_type &key) {
+        return shards[shard_index(key)];
+    }
+
+    const shard &shard_for(const key_type &key) const {
+        return shards[shard_index(key)];
+    }
+};
+
+/**
+ *  @brief  Concurrent map for read-mostly data whose readers take no lock
+ *          and write no shared memory.
+ *
+ *  Uses the hash_map control bytes, but probes whole aligned groups of
+ *  ctrl_group::width slots, each guarded by a sequence counter. A writer makes the
+ *  counter odd, updates the group and makes it even again; a reader copies
+ *  the group's control bytes and candidate slots and retries if the counter
+ *  moved meanwhile. Only copies that survive that check reach Pred, so a
+ *  comparison never sees a torn or half-written key. Readers copy with
+ *  relaxed atomic loads and writers store whole slots and control words
+ *  with relaxed atomic stores of the same widths, so the race is benign
+ *  under the C++ memory model. Writers serialize on a mutex. Keys and
+ *  values must be trivially copyable.
+ *
+ *  Growing publishes a new table through an atomic pointer. Readers can still
+ *  be inside the old one, so retired tables are freed only with the map,
+ *  which costs at most as much memory again as the live table.
+ */
+template<typename K, typename T,
+        typename Hash = std::hash<K>,
+        typename Pred = std::equal_to<K>>
+class read_mostly_hash_map {
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                  "read_mostly_hash_map copies slots optimistically and needs trivially copyable types");
+public:
+    using key_type = K;
+    using mapped_type = T;
+    using size_type = std::size_t;
+
+    read_mostly_hash_map() : table_(nullptr) {
+        publish(new table(1));
+    }
+
+    read_mostly_hash_map(const read_mostly_hash_map &) = delete;
+
+    read_mostly_hash_map &operator=(const read_mostly_hash_map &) = delete;
+
+    ~read_mostly_hash_map() {
+        for (table *t : tables)
+            delete t;
+    }
+
+    /// Lock-free: copies the value of @a key into @a value, returns false when absent.
+    bool find(const key_type &key, mapped_type &value) const {
+        const table *t = table_.load(std::memory_order_acquire);
+        size_t hash = hash_of(key);
+        ctrl_t tag = h2(hash);
+        size_type g = fastrange_index::index(hash, t->groups);
+        for (size_type probed = 0; probed < t->groups; ++probed) {
+            ctrl_t ctrl[ctrl_group::width];
+            slot candidates[ctrl_group::width];
+            size_type count;
+            bool empty;
+            while (true) {
+                uint32_t version = t->versions[g].load(std::memory_order_acquire);
+                if (version & 1u)
+                    continue;
+                const size_type base = g * ctrl_group::width;
+                relaxed_load(ctrl, t->ctrl.get() + base, sizeof(ctrl));
+                ctrl_group group(ctrl);
+                count = 0;
+                for (uint32_t mask = group.match(tag); mask != 0; mask &= mask - 1)
+                    relaxed_load(&candidates[count++], t->slots.get() + base + lowest_bit(mask), sizeof(slot));
+                empty = group.match_empty() != 0;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (t->versions[g].load(std::memory_order_relaxed) == version)
+                    break;
+            }
+            for (size_type i = 0; i < count; ++i) {
+                if (equal_(candidates[i].key, key)) {
+                    value = candidates[i].value;
+                    return true;
+                }
+            }
+            if (empty)
+                return false;
+            g = g + 1 == t->groups ? 0 : g + 1;
+        }
+        return false;
+    }
+
+    bool contains(const key_type &key) const {
+        mapped_type ignored;
+        return find(key, ignored);
+    }
+
+    /// Returns false and leaves the map unchanged when @a key is already present.
+    bool insert(const key_type &key, const mapped_type &value) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        return write(key, value, false);
+    }
+
+    /// Returns true when @a key was inserted, false when its value was replaced.
+    bool insert_or_assign(const key_type &key, const mapped_type &value) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        return write(key, value, true);
+    }
+
+    bool erase(const key_type &key) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        table *t = table_.load(std::memory_order_relaxed);
+        size_type index = locate(*t, key, hash_of(key));
+        if (index == t->capacity)
+            return false;
+        size_type g = index / ctrl_group::width;
+        begin_write(*t, g);
+        store_ctrl(*t, index, DELETED);
+        end_write(*t, g);
+        --t->size;
+        ++t->tombstones;
+        return true;
+    }
+
+    size_type size() const {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        return table_.load(std::memory_order_relaxed)->size;
+    }
+
+private:
+    struct slot {
+        K key;
+        T value;
+    };
+
+    struct table {
+        size_type groups, capacity;
+        size_type size = 0, tombstones = 0;
+        std::unique_ptr<ctrl_t[]> ctrl;
+        std::unique_ptr<slot[]> slots;
+        std::unique_ptr<std::atomic<uint32_t>[]> versions;
+
+        explicit table(size_type groups) :
+                groups(groups), capacity(groups * ctrl_group::width),
+                ctrl(new ctrl_t[capacity]), slots(new slot[capacity]),
+                versions(new std::atomic<uint32_t>[groups]) {
+            std::fill(ctrl.get(), ctrl.get() + capacity, static_cast<ctrl_t>(EMPTY));
+            for (size_type g = 0; g < groups; ++g)
+                versions[g].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    /// Full and deleted slots together may not pass 7/8 of the table.
+    static constexpr size_type max_load_num = 7, max_load_den = 8;
+
+    std::atomic<table *> table_;
+    std::vector<table *> tables;
+    mutable std::mutex write_mutex;
+    Hash hasher_;
+    Pred equal_;
+
+    size_t hash_of(const key_type &key) const {
+        size_t hash = hasher_(key);
+        return is_avalanching<Hash>::value ? hash : mix_hash(hash);
+    }
+
+    static ctrl_t h2(size_t hash) {
+        return fastrange_index::tag(hash);
+    }
+
+    /**
+     *  Copies @a n bytes with relaxed atomic loads: whole words where the
+     *  source is word-aligned, single bytes elsewhere. relaxed_store splits
+     *  the same range the same way, so each load pairs with a store of its
+     *  own size and address.
+     */
+    static void relaxed_load(void *dst, const void *src, std::size_t n) {
+        auto *to = static_cast<unsigned char *>(dst);
+        auto *from = static_cast<const unsigned char *>(src);
+        while (n != 0) {
+            if (n >= sizeof(uint64_t) && reinterpret_cast<uintptr_t>(from) % alignof(uint64_t) == 0) {
+                uint64_t word = __atomic_load_n(reinterpret_cast<const uint64_t *>(from), __ATOMIC_RELAXED);
+                std::memcpy(to, &word, sizeof(word));
+                to += sizeof(word);
+                from += sizeof(word);
+                n -= sizeof(word);
+            } else {
+                *to++ = __atomic_load_n(from++, __ATOMIC_RELAXED);
+                --n;
+            }
+        }
+    }
+
+    static void relaxed_store(void *dst, const void *src, std::size_t n) {
+        auto *to = static_cast<unsigned char *>(dst);
+        auto *from = static_cast<const unsigned char *>(src);
+        while (n != 0) {
+            if (n >= sizeof(uint64_t) && reinterpret_cast<uintptr_t>(to) % alignof(uint64_t) == 0) {
+                uint64_t word;
+                std::memcpy(&word, from, sizeof(word));
+                __atomic_store_n(reinterpret_cast<uint64_t *>(to), word, __ATOMIC_RELAXED);
+                to += sizeof(word);
+                from += sizeof(word);
+                n -= sizeof(word);
+            } else {
+                __atomic_store_n(to++, *from++, __ATOMIC_RELAXED);
+                --n;
+            }
+        }
+    }
+
+    /// Rewrites the whole control word holding @a index, the width readers load it with.
+    static void store_ctrl(table &t, size_type index, ctrl_t c) {
+        ctrl_t *word = t.ctrl.get() + index / sizeof(uint64_t) * sizeof(uint64_t);
+        ctrl_t bytes[sizeof(uint64_t)];
+        std::memcpy(bytes, word, sizeof(bytes));
+        bytes[index % sizeof(uint64_t)] = c;
+        relaxed_store(word, bytes, sizeof(bytes));
+    }
+
+    static void begin_write(table &t, size_type g) {
+        t.versions[g].store(t.versions[g].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void end_write(table &t, size_type g) {
+        t.versions[g].store(t.versions[g].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void publish(table *t) {
+        tables.push_back(t);
+        table_.store(t, std::memory_order_release);
+    }
+
+    /// Writer-side lookup; the caller holds write_mutex, so no validation is needed.
+    size_type locate(const table &t, const key_type &key, size_t hash) const {
+        ctrl_t tag = h2(hash);
+        size_type g = fastrange_index::index(hash, t.groups);
+        for (size_type probed = 0; probed < t.groups; ++probed) {
+            const size_type base = g * ctrl_group::width;
+            ctrl_group group(t.ctrl.get() + base);
+            for (uint32_t mask = group.match(tag); mask != 0; mask &= mask - 1) {
+                if (equal_(t.slots[base + lowest_bit(mask)].key, key))
+                    return base + lowest_bit(mask);
+            }
+            if (group.match_empty() != 0)
+                return t.capacity;
+            g = g + 1 == t.groups ? 0 : g + 1;
+        }
+        return t.capacity;
+    }
+
+    /// Puts an absent key into the first group with an empty or deleted slot.
+    static void place(table &t, const slot &s, size_t hash) {
+        size_type g = fastrange_index::index(hash, t.groups);
+        while (true) {
+            const size_type base = g * ctrl_group::width;
+            uint32_t mask = ctrl_group(t.ctrl.get() + base).match_empty_or_deleted();
+            if (mask != 0) {
+                size_type index = base + lowest_bit(mask);
+                begin_write(t, g);
+                if (t.ctrl[index] == DELETED)
+                    --t.tombstones;
+                relaxed_store(&t.slots[index], &s, sizeof(slot));
+                store_ctrl(t, index, h2(hash));
+                end_write(t, g);
+                ++t.size;
+                return;
+            }
+            g = g + 1 == t.groups ? 0 : g + 1;
+        }
+    }
+
+    bool write(const key_type &key, const mapped_type &value, bool assign) {
+        table *t = table_.load(std::memory_order_relaxed);
+        size_t hash = hash_of(key);
+        size_type index = locate(*t, key, hash);
+        if (index != t->capacity) {
+            if (assign) {
+                size_type g = index / ctrl_group::width;
+                slot updated = t->slots[index];
+                updated.value = value;
+                begin_write(*t, g);
+                relaxed_store(&t->slots[index], &updated, sizeof(slot));
+                end_write(*t, g);
+            }
+            return false;
+        }
+        if ((t->size + t->tombstones + 1) * max_load_den > t->capacity * max_load_num)
+            t = rebuild(*t);
+        place(*t, slot{key, value}, hash);
+        return true;
+    }
+
+    /// Copies the live slots into a fresh table (twice as large unless most of
+    /// the load was tombstones) and publishes it.
+    table *rebuild(const table &old) {
+        size_type groups = old.groups;
+        if ((old.size + 1) * max_load_den * 2 > old.capacity * max_load_num)
+            groups *= 2;
+        table *t = new table(groups);
+        for (size_type i = 0; i < old.capacity; ++i) {
+            if (is_full(old.ctrl[i]))
+                place(*t, old.slots[i], hash_of(old.slots[i].key));
+        }
+        publish(t);
+        return t;
+    }
+};
+
+/**
+ *  @brief  Map whose tags and keys share 64-byte buckets, so a lookup
+ *          usually reads one cache line plus, on a hit, its value.
+ *
+ *  Each bucket holds as many slots as fit in a cache line: their control
+ *  bytes followed by their keys. Values are stored in the bucket too when
+ *  that costs at most half of the slots (small T), and in a parallel array
+ *  otherwise. Buckets are probed linearly, a probe ends at a bucket with an
+ *  empty slot, and erase leaves DELETED tags behind like hash_map does.
+ *  Keys and values must be trivially copyable.
+ */
+template<typename K, typename T,
+        typename Hash = std::hash<K>,
+        typename Pred = std::equal_to<K>>
+class bucket_hash_map {
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                  "bucket_hash_map packs slots into raw cache lines and needs trivially copyable types");
+
+    static constexpr std::size_t cache_line = 64;
+
+    static constexpr std::size_t round_up(std::size_t n, std::size_t align) {
+        return (n + align - 1) / align * align;
+    }
+
+    static constexpr std::size_t bucket_bytes(std::size_t slots, bool with_values) {
+        std::size_t bytes = round_up(slots, alignof(K)) + slots * sizeof(K);
+        return with_values ? round_up(bytes, alignof(T)) + slots * sizeof(T) : bytes;
+    }
+
+    static constexpr std::size_t max_slots(bool with_values) {
+        std::size_t slots = 0;
+        while (slots < 32 && bucket_bytes(slots + 1, with_values) <= cache_line)
+            ++slots;
+        return slots;
+    }
+
+public:
+    using key_type = K;
+    using mapped_type = T;
+    using size_type = std::size_t;
+
+    static constexpr bool inline_values = max_slots(true) * 2 >= max_slots(false);
+    static constexpr size_type slots_per_bucket = max_slots(inline_values);
+    static_assert(slots_per_bucket != 0, "key too large for a 64-byte bucket");
+
+    bucket_hash_map() {
+        allocate(1);
+    }
+
+    explicit bucket_hash_map(size_type n) {
+        allocate(buckets_for(n));
+    }
+
+    bucket_hash_map(const bucket_hash_map &other) : bucket_hash_map(other.size_) {
+        hasher_ = other.hasher_;
+        equal_ = other.equal_;
+        other.for_each([this](const key_type &key, const mapped_type &value) { insert(key, value); });
+    }
+
+    /// Leaves @a other empty but usable, so it allocates one bucket.
+    bucket_hash_map(bucket_hash_map &&other) : bucket_hash_map() {
+        swap(other);
+    }
+
+    bucket_hash_map &operator=(bucket_hash_map other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    size_type size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    /// Number of slots, not of 64-byte buckets.
+    size_type bucket_count() const noexcept {
+        return buckets * slots_per_bucket;
+    }
+
+    Hash hash_function() const {
+        return hasher_;
+    }
+
+    Pred key_eq() const {
+        return equal_;
+    }
+
+    mapped_type *find(const key_type &key) {
+        size_type i = locate(key, hash_of(key));
+        return i == npos ? nullptr : &value_at(i);
+    }
+
+    const mapped_type *find(const key_type &key) const {
+        return const_cast<bucket_hash_map *>(this)->find(key);
+    }
+
+    bool contains(const key_type &key) const {
+        return find(key) != nullptr;
+    }
+
+    mapped_type &at(const key_type &key) {
+        mapped_type *value = find(key);
+        if (value == nullptr)
+            throw std::out_of_range("item not found");
+        return *value;
+    }
+
+    const mapped_type &at(const key_type &key) const {
+        return const_cast<bucket_hash_map *>(this)->at(key);
+    }
+
+    /// Returns false and leaves the map unchanged when @a key is already present.
+    bool insert(const key_type &key, const mapped_type &value) {
+        return write(key, value, false);
+    }
+
+    /// Inserts or overwrites; returns true when the key was new.
+    bool insert_or_assign(const key_type &key, const mapped_type &value) {
+        return write(key, value, true);
+    }
+
+    bool erase(const key_type &key) {
+        size_type i = locate(key, hash_of(key));
+        if (i == npos)
+            return false;
+        table[i / slots_per_bucket].tags[i % slots_per_bucket] = DELETED;
+        --size_;
+        ++tombstones;
+        return true;
+    }
+
+    void reserve(size_type n) {
+        if (buckets_for(n) > buckets)
+            rebuild(buckets_for(n));
+    }
+
+    /// Calls fn(key, value) for every element.
+    template<typename F>
+    void for_each(F fn) const {
+        for (size_type b = 0; b < buckets; ++b) {
+            for (size_type s = 0; s < slots_per_bucket; ++s) {
+                if (is_full(table[b].tags[s]))
+                    fn(table[b].keys[s], const_cast<bucket_hash_map *>(this)->value_at(b * slots_per_bucket + s));
+            }
+        }
+    }
+
+    void swap(bucket_hash_map &other) noexcept {
+        std::swap(table, other.table);
+        std::swap(values, other.values);
+        std::swap(buckets, other.buckets);
+        std::swap(size_, other.size_);
+        std::swap(tombstones, other.tombstones);
+        std::swap(hasher_, other.hasher_);
+        std::swap(equal_, other.equal_);
+    }
+
+private:
+    struct alignas(cache_line) keys_only_bucket {
+        ctrl_t tags[slots_per_bucket];
+        K keys[slots_per_bucket];
+    };
+
+    struct alignas(cache_line) inline_bucket {
+        ctrl_t tags[slots_per_bucket];
+        K keys[slots_per_bucket];
+        T values[slots_per_bucket];
+    };
+
+    using bucket = typename std::conditional<inline_values, inline_bucket, keys_only_bucket>::type;
+    static_assert(sizeof(bucket) == cache_line, "a bucket must fill exactly one cache line");
+
+    static constexpr size_type max_load_num = 7, max_load_den = 8;
+    static constexpr size_type npos = static_cast<size_type>(-1);
+
+    std::unique_ptr<bucket[]> table;
+    /// Values by slot index when they do not fit in the buckets.
+    std::unique_ptr<T[]> values;
+    size_type buckets = 0, size_ = 0, tombstones = 0;
+    Hash hasher_;
+    Pred equal_;
+
+    static size_type buckets_for(size_type n) {
+        size_type slots = n * max_load_den / max_load_num + 1;
+        return std::max<size_type>(1, (slots + slots_per_bucket - 1) / slots_per_bucket);
+    }
+
+    void allocate(size_type n) {
+        table.reset(new bucket[n]);
+        for (size_type b = 0; b < n; ++b)
+            std::memset(table[b].tags, EMPTY, slots_per_bucket);
+        if (!inline_values)
+            values.reset(new T[n * slots_per_bucket]);
+        buckets = n;
+        size_ = tombstones = 0;
+    }
+
+    size_t hash_of(const key_type &key) const {
+        size_t hash = hasher_(key);
+        return is_avalanching<Hash>::value ? hash : mix_hash(hash);
+    }
+
+    mapped_type &value_at(size_type i) {
+        if constexpr (inline_values)
+            return table[i / slots_per_bucket].values[i % slots_per_bucket];
+        else
+            return values[i];
+    }
+
+    /// Bitmask of the bucket's slots whose tag equals @a tag. A bucket starts
+    /// with its tags and is a whole cache line, so one ctrl_group load covers them.
+    static uint32_t match(const ctrl_t *tags, ctrl_t tag) {
+        if constexpr (slots_per_bucket <= ctrl_group::width)
+            return ctrl_group(tags).match(tag) & static_cast<uint32_t>((uint64_t(1) << slots_per_bucket) - 1);
+        uint32_t mask = 0;
+        for (size_type s = 0; s < slots_per_bucket; ++s)
+            mask |= static_cast<uint32_t>(tags[s] == tag) << s;
+        return mask;
+    }
+
+    static bool has_empty(const ctrl_t *tags) {
+        return match(tags, EMPTY) != 0;
+    }
+
+    size_type locate(const key_type &key, size_t hash) const {
+        const ctrl_t tag = fastrange_index::tag(hash);
+        size_type b = fastrange_index::index(hash, buckets);
+        for (size_type probed = 0; probed < buckets; ++probed) {
+            const bucket &current = table[b];
+            for (uint32_t mask = match(current.tags, tag); mask != 0; mask &= mask - 1) {
+                if (equal_(current.keys[lowest_bit(mask)], key))
+                    return b * slots_per_bucket + lowest_bit(mask);
+            }
+            if (has_empty(current.tags))
+                return npos;
+            b = b + 1 == buckets ? 0 : b + 1;
+        }
+        return npos;
+    }
+
+    /// Puts an absent key into the first empty or deleted slot on its probe path.
+    void place(const key_type &key, const mapped_type &value, size_t hash) {
+        size_type b = fastrange_index::index(hash, buckets);
+        while (true) {
+            bucket &current = table[b];
+            for (size_type s = 0; s < slots_per_bucket; ++s) {
+                if (!is_full(current.tags[s])) {
+                    if (current.tags[s] == DELETED)
+                        --tombstones;
+                    current.tags[s] = fastrange_index::tag(hash);
+                    current.keys[s] = key;
+                    value_at(b * slots_per_bucket + s) = value;
+                    ++size_;
+                    return;
+                }
+            }
+            b = b + 1 == buckets ? 0 : b + 1;
+        }
+    }
+
+    bool write(const key_type &key, const mapped_type &value, bool assign) {
+        size_t hash = hash_of(key);
+        size_type i = locate(key, hash);
+        if (i != npos) {
+            if (assign)
+                value_at(i) = value;
+            return false;
+        }
+        if ((size_ + tombstones + 1) * max_load_den > bucket_count() * max_load_num)
+            rebuild(size_ * 2 * max_load_den > bucket_count() * max_load_num ? buckets * 2 : buckets);
+        place(key, value, hash);
+        return true;
+    }
+
+    void rebuild(size_type n) {
+        bucket_hash_map bigger;
+        bigger.hasher_ = hasher_;
+        bigger.equal_ = equal_;
+        bigger.allocate(n);
+        for_each([&bigger](const key_type &key, const mapped_type &value) {
+            bigger.place(key, value, bigger.hash_of(key));
+        });
+        swap(bigger);
+    }
+};
+
+/**
+ *  @brief  Cuckoo hash map: every key sits in one of two 4-slot buckets or
+ *          in a small stash, so find() does O(1) work in the worst case.
+ *
+ *  The first bucket of a key comes from its hash and the second from the
+ *  hash remixed with a per-table seed. A bucket is one aligned cache line
+ *  with four control bytes and four keys, plus the values when they fit
+ *  and a parallel array otherwise. A lookup therefore compares keys in at
+ *  most two cache lines, and then in the stash, which holds at most
+ *  stash_size keys and is empty in a healthy table. When both buckets of a
+ *  new key are full, insert searches breadth-first for the shortest chain
+ *  of at most max_path moves that ends in a free slot. That keeps the
+ *  table usable up to 95% full. A key that finds neither a chain nor room
+ *  in the stash makes the table rebuild with a new seed, and every few
+ *  failed seeds the table doubles. Keys and values must be trivially copyable.
+ */
+template<typename K, typename T,
+        typename Hash = std::hash<K>,
+        typename Pred = std::equal_to<K>>
+class cuckoo_hash_map {
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                  "cuckoo_hash_map packs slots into raw cache lines and needs trivially copyable types");
+
+    static constexpr std::size_t cache_line = 64;
+    static constexpr std::size_t ways = 4;
+
+    struct keys_only_layout {
+        ctrl_t tags[ways];
+        K keys[ways];
+    };
+
+    struct inline_layout {
+        ctrl_t tags[ways];
+        K keys[ways];
+        T values[ways];
+    };
+
+    /// Smallest power of two holding @a bytes, so an aligned bucket never straddles a line.
+    static constexpr std::size_t line_for(std::size_t bytes) {
+        std::size_t line = 1;
+        while (line < bytes)
+            line *= 2;
+        return line;
+    }
+
+public:
+    using key_type = K;
+    using mapped_type = T;
+    using size_type = std::size_t;
+
+    static constexpr size_type slots_per_bucket = ways;
+    static constexpr bool inline_values = line_for(sizeof(inline_layout)) <= cache_line;
+    static constexpr size_type stash_size = 8;
+    static constexpr size_type max_path = 5;
+
+    cuckoo_hash_map() {
+        allocate(1);
+    }
+
+    explicit cuckoo_hash_map(size_type n) {
+        allocate(buckets_for(n));
+    }
+
+    cuckoo_hash_map(const cuckoo_hash_map &other) : cuckoo_hash_map(other.size_) {
+        hasher_ = other.hasher_;
+        equal_ = other.equal_;
+        other.for_each([this](const key_type &key, const mapped_type &value) { insert(key, value); });
+    }
+
+    /// Leaves @a other empty but usable, so it allocates one bucket.
+    cuckoo_hash_map(cuckoo_hash_map &&other) : cuckoo_hash_map() {
+        swap(other);
+    }
+
+    cuckoo_hash_map &operator=(cuckoo_hash_map other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    size_type size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    /// Number of slots in the buckets; the stash is not counted.
+    size_type bucket_count() const noexcept {
+        return buckets * slots_per_bucket;
+    }
+
+    float load_factor() const noexcept {
+        return static_cast<float>(size_) / bucket_count();
+    }
+
+    /// Keys that found no room in either of their buckets.
+    size_type stash_count() const noexcept {
+        return stashed;
+    }
+
+    mapped_type *find(const key_type &key) {
+        return lookup(key, homes_of(hash_of(key)));
+    }
+
+    const mapped_type *find(const key_type &key) const {
+        return const_cast<cuckoo_hash_map *>(this)->find(key);
+    }
+
+    bool contains(const key_type &key) const {
+        return find(key) != nullptr;
+    }
+
+    mapped_type &at(const key_type &key) {
+        mapped_type *value = find(key);
+        if (value == nullptr)
+            throw std::out_of_range("item not found");
+        return *value;
+    }
+
+    const mapped_type &at(const key_type &key) const {
+        return const_cast<cuckoo_hash_map *>(this)->at(key);
+    }
+
+    /// Returns false and leaves the map unchanged when @a key is already present.
+    bool insert(const key_type &key, const mapped_type &value) {
+        return write(key, value, false);
+    }
+
+    /// Inserts or overwrites; returns true when the key was new.
+    bool insert_or_assign(const key_type &key, const mapped_type &value) {
+        return write(key, value, true);
+    }
+
+    /// Frees the slot outright: lookups check both buckets whole, so no tombstone is needed.
+    bool erase(const key_type &key) {
+        homes h = homes_of(hash_of(key));
+        size_type i = locate(key, h);
+        if (i != npos) {
+            table[i / ways].tags[i % ways] = EMPTY;
+            --size_;
+            if (stashed != 0)
+                unstash();
+            return true;
+        }
+        for (size_type s = 0; s < stashed; ++s) {
+            if (equal_(stash[s].key, key)) {
+                stash[s] = stash[--stashed];
+                --size_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void reserve(size_type n) {
+        if (buckets_for(n) > buckets)
+            rebuild(buckets_for(n));
+    }
+
+    /// Calls fn(key, value) for every element.
+    template<typename F>
+    void for_each(F fn) const {
+        for (size_type b = 0; b < buckets; ++b) {
+            for (size_type s = 0; s < ways; ++s) {
+                if (is_full(table[b].tags[s]))
+                    fn(table[b].keys[s], const_cast<cuckoo_hash_map *>(this)->value_at(b * ways + s));
+            }
+        }
+        for (size_type s = 0; s < stashed; ++s)
+            fn(stash[s].key, stash[s].value);
+    }
+
+    void swap(cuckoo_hash_map &other) noexcept {
+        std::swap(table, other.table);
+        std::swap(values, other.values);
+        std::swap(buckets, other.buckets);
+        std::swap(size_, other.size_);
+        std::swap(stash, other.stash);
+        std::swap(stashed, other.stashed);
+        std::swap(seed, other.seed);
+        std::swap(hasher_, other.hasher_);
+        std::swap(equal_, other.equal_);
+    }
+
+private:
+    using layout = typename std::conditional<inline_values, inline_layout, keys_only_layout>::type;
+
+    struct alignas(line_for(sizeof(layout))) bucket : layout {
+    };
+    static_assert(sizeof(bucket) <= cache_line, "key too large for a 64-byte bucket");
+
+    struct entry {
+        K key;
+        T value;
+    };
+
+    /// The two candidate buckets of a hash and the tag stored with it.
+    struct homes {
+        size_type first, second;
+        ctrl_t tag;
+    };
+
+    static constexpr size_type max_load_num = 19, max_load_den = 20;
+    static constexpr size_type npos = static_cast<size_type>(-1);
+    /// Rebuilds with a fresh seed this many times before doubling the table.
+    static constexpr int seeds_per_size = 4;
+    static constexpr int max_rebuilds = 4 * seeds_per_size;
+
+    std::unique_ptr<bucket[]> table;
+    /// Values by slot index when they do not fit in the buckets.
+    std::unique_ptr<T[]> values;
+    size_type buckets = 0, size_ = 0, stashed = 0;
+    std::array<entry, stash_size> stash{};
+    size_t seed = static_cast<size_t>(0x632BE59BD9B4E019ull);
+    Hash hasher_;
+    Pred equal_;
+
+    static size_type buckets_for(size_type n) {
+        size_type slots = n * max_load_den / max_load_num + 1;
+        return std::max<size_type>(1, (slots + ways - 1) / ways);
+    }
+
+    void allocate(size_type n) {
+        table.reset(new bucket[n]);
+        for (size_type b = 0; b < n; ++b)
+            std::memset(table[b].tags, EMPTY, ways);
+        if (!inline_values)
+            values.reset(new T[n * ways]);
+        buckets = n;
+        size_ = stashed = 0;
+    }
+
+    size_t hash_of(const key_type &key) const {
+        size_t hash = hasher_(key);
+        return is_avalanching<Hash>::value ? hash : mix_hash(hash);
+    }
+
+    homes homes_of(size_t hash) const {
+        size_type first = fastrange_index::index(hash, buckets);
+        size_type second = fastrange_index::index(mix_hash(hash ^ seed), buckets);
+        if (second == first)
+            second = first + 1 == buckets ? 0 : first + 1;
+        return {first, second, fastrange_index::tag(hash)};
+    }
+
+    /// The bucket other than @a b that the key in it may live in.
+    size_type other_bucket(size_type b, size_type s) const {
+        homes h = homes_of(hash_of(table[b].keys[s]));
+        return h.first == b ? h.second : h.first;
+    }
+
+    mapped_type &value_at(size_type i) {
+        if constexpr (inline_values)
+            return table[i / ways].values[i % ways];
+        else
+            return values[i];
+    }
+
+    size_type free_slot(size_type b) const {
+        for (size_type s = 0; s < ways; ++s) {
+            if (table[b].tags[s] == EMPTY)
+                return s;
+        }
+        return npos;
+    }
+
+    /**
+     *  Matches the eight tags of both buckets in one 64-bit word before
+     *  comparing any key. Branching on which bucket holds a key mispredicts
+     *  on about a third of the hits at high load, and each misprediction
+     *  stops the lookups that follow from overlapping their cache misses
+     *  with this one.
+     */
+    size_type locate(const key_type &key, const homes &h) const {
+        uint32_t first, second;
+        std::memcpy(&first, table[h.first].tags, ways);
+        std::memcpy(&second, table[h.second].tags, ways);
+        // Bytes equal to the tag become zero; the exact zero-byte test then
+        // leaves bit 7 of each of them set.
+        uint64_t x = (first | static_cast<uint64_t>(second) << 32) ^
+                     (0x0101010101010101ull * static_cast<uint8_t>(h.tag));
+        uint64_t low7 = 0x7F7F7F7F7F7F7F7Full;
+        uint64_t mask = ~(((x & low7) + low7) | x | low7);
+        const size_type candidates[2] = {h.first, h.second};
+        for (; mask != 0; mask &= mask - 1) {
+            size_type i = static_cast<size_type>(__builtin_ctzll(mask)) / 8;
+            size_type b = candidates[i / ways], s = i % ways;
+            if (equal_(table[b].keys[s], key))
+                return b * ways + s;
+        }
+        return npos;
+    }
+
+    mapped_type *lookup(const key_type &key, const homes &h) {
+        size_type i = locate(key, h);
+        if (i != npos)
+            return &value_at(i);
+        for (size_type s = 0; s < stashed; ++s) {
+            if (equal_(stash[s].key, key))
+                return &stash[s].value;
+        }
+        return nullptr;
+    }
+
+    void put(size_type b, size_type s, ctrl_t tag, const key_type &key, const mapped_type &value) {
+        table[b].tags[s] = tag;
+        table[b].keys[s] = key;
+        value_at(b * ways + s) = value;
+    }
+
+    void move(size_type from, size_type from_slot, size_type to, size_type to_slot) {
+        put(to, to_slot, table[from].tags[from_slot], table[from].keys[from_slot], value_at(from * ways + from_slot));
+        table[from].tags[from_slot] = EMPTY;
+    }
+
+    /**
+     *  Breadth-first search from both buckets of a new key for the shortest
+     *  chain of moves, each element to its other bucket, that ends in a
+     *  free slot. A chain never visits a bucket twice. The moves are made
+     *  from the far end back.
+     *  @return  The slot freed in one of @a h's buckets, or npos when no
+     *           chain of max_path moves exists.
+     */
+    size_type make_room(const homes &h) {
+        struct node {
+            size_type bucket, parent, slot, depth;
+        };
+        std::vector<node> nodes{{h.first, npos, 0, 0}, {h.second, npos, 0, 0}};
+        for (size_type n = 0; n < nodes.size(); ++n) {
+            const node current = nodes[n];
+            for (size_type s = 0; s < ways; ++s) {
+                size_type to = other_bucket(current.bucket, s);
+                bool cycle = false;
+                for (size_type a = n; a != npos && !cycle; a = nodes[a].parent)
+                    cycle = nodes[a].bucket == to;
+                if (cycle)
+                    continue;
+                size_type to_slot = free_slot(to);
+                if (to_slot != npos) {
+                    size_type from = current.bucket, from_slot = s;
+                    for (size_type a = n;; a = nodes[a].parent) {
+                        move(from, from_slot, to, to_slot);
+                        to = from;
+                        to_slot = from_slot;
+                        if (nodes[a].parent == npos)
+                            return to * ways + to_slot;
+                        from = nodes[nodes[a].parent].bucket;
+                        from_slot = nodes[a].slot;
+                    }
+                }
+                if (current.depth + 1 < max_path)
+                    nodes.push_back({to, n, s, current.depth + 1});
+            }
+        }
+        return npos;
+    }
+
+    /// Puts an absent key into one of its buckets, moving others aside if
+    /// needed, or into the stash. False, with nothing changed, when all is full.
+    bool place(const key_type &key, const mapped_type &value, size_t hash) {
+        homes h = homes_of(hash);
+        size_type i = npos;
+        if (size_type s = free_slot(h.first); s != npos)
+            i = h.first * ways + s;
+        else if (size_type s2 = free_slot(h.second); s2 != npos)
+            i = h.second * ways + s2;
+        else
+            i = make_room(h);
+        if (i != npos) {
+            put(i / ways, i % ways, h.tag, key, value);
+        } else {
+            if (stashed == stash_size)
+                return false;
+            stash[stashed++] = entry{key, value};
+        }
+        ++size_;
+        return true;
+    }
+
+    /// Moves stashed keys back into their buckets where an erase made room.
+    void unstash() {
+        for (size_type s = 0; s < stashed;) {
+            homes h = homes_of(hash_of(stash[s].key));
+            size_type b = h.first, slot = free_slot(b);
+            if (slot == npos)
+                slot = free_slot(b = h.second);
+            if (slot == npos) {
+                ++s;
+                continue;
+            }
+            put(b, slot, h.tag, stash[s].key, stash[s].value);
+            stash[s] = stash[--stashed];
+        }
+    }
+
+    bool write(const key_type &key, const mapped_type &value, bool assign) {
+        size_t hash = hash_of(key);
+        if (mapped_type *found = lookup(key, homes_of(hash))) {
+            if (assign)
+                *found = value;
+            return false;
+        }
+        if ((size_ + 1) * max_load_den > bucket_count() * max_load_num)
+            rebuild(buckets * 2);
+        if (!place(key, value, hash)) {
+            entry pending{key, value};
+            rebuild(buckets, &pending);
+        }
+        return true;
+    }
+
+    /**
+     *  Rehashes every element, and @a extra if given, into @a n buckets
+     *  under a new seed, trying further seeds and doubling @a n every
+     *  seeds_per_size failures.
+     *  @throw  std::length_error when no table holds the keys after
+     *          max_rebuilds attempts, as when more than 2 * ways + stash_size
+     *          keys share a hash. The map is left unchanged.
+     */
+    void rebuild(size_type n, const entry *extra = nullptr) {
+        size_t next_seed = seed;
+        for (int attempt = 0; attempt < max_rebuilds; ++attempt) {
+            if (attempt != 0 && attempt % seeds_per_size == 0)
+                n *= 2;
+            next_seed = mix_hash(next_seed + 1);
+            cuckoo_hash_map bigger;
+            bigger.hasher_ = hasher_;
+            bigger.equal_ = equal_;
+            bigger.seed = next_seed;
+            bigger.allocate(n);
+            bool placed = true;
+            for (size_type b = 0; b < buckets && placed; ++b) {
+                for (size_type s = 0; s < ways && placed; ++s) {
+                    if (is_full(table[b].tags[s]))
+                        placed = bigger.place(table[b].keys[s], value_at(b * ways + s),
+                                              bigger.hash_of(table[b].keys[s]));
+                }
+            }
+            for (size_type s = 0; s < stashed && placed; ++s)
+                placed = bigger.place(stash[s].key, stash[s].value, bigger.hash_of(stash[s].key));
+            if (placed && extra != nullptr)
+                placed = bigger.place(extra->key, extra->value, bigger.hash_of(extra->key));
+            if (placed) {
+                swap(bigger);
+                return;
+            }
+        }
+        throw std::length_error("cuckoo_hash_map: too many keys share both buckets");
+    }
+};
+
+/// Mapped type of a flat_map that stores no values; flat_set is built on it.
+struct no_value {
+};
+
+/**
+ *  @brief  Compact map for integer keys with no control bytes: two key
+ *          values mark empty and deleted slots.
+ *
+ *  Slots come in blocks of one key_group followed by the values of those
+ *  keys (none when T is empty). A probe compares the key itself against a
+ *  whole group, so there are no tag collisions to rule out, and a hit
+ *  finds its value in the same block. Blocks whose size is a power of two
+ *  are aligned to it and never straddle cache lines. Full and deleted
+ *  slots together may reach max_load_factor(), at most 7/8 of the table.
+ *  The two sentinel keys can still be stored; they are kept outside the
+ *  table.
+ */
+template<typename K, typename T, typename Hash = std::hash<K>>
+class flat_map {
+    static_assert(std::is_integral<K>::value, "flat_map reserves two key values and needs integer keys");
+    static_assert(std::is_trivially_copyable<T>::value, "flat_map copies values around as raw memory");
+
+    static constexpr std::size_t width = key_group<K>::width;
+
+public:
+    using key_type = K;
+    using mapped_type = T;
+    using size_type = std::size_t;
+
+    static constexpr K empty_key = std::numeric_limits<K>::max();
+    static constexpr K deleted_key = empty_key - 1;
+
+    /// Highest load factor, tombstones included, that max_load_factor() accepts.
+    static constexpr float load_limit = 0.875f;
+
+    flat_map() {
+        allocate(1);
+    }
+
+    explicit flat_map(size_type n) {
+        allocate(groups_for(n));
+    }
+
+    flat_map(const flat_map &other) : max_load(other.max_load) {
+        allocate(groups_for(other.size_));
+        hasher_ = other.hasher_;
+        other.for_each([this](key_type key, const mapped_type &value) { insert(key, value); });
+    }
+
+    /// Leaves @a other empty but usable, so it allocates one group.
+    flat_map(flat_map &&other) : flat_map() {
+        swap(other);
+    }
+
+    flat_map &operator=(flat_map other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    size_type size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    size_type bucket_count() const noexcept {
+        return groups * width;
+    }
+
+    float load_factor() const noexcept {
+        return static_cast<float>(size_) / bucket_count();
+    }
+
+    float max_load_factor() const noexcept {
+        return max_load;
+    }
+
+    /// Takes effect at the next insert.
+    void max_load_factor(float f) {
+        if (!(f > 0 && f <= load_limit))
+            throw std::invalid_argument("flat_map max_load_factor must be in (0, 0.875]");
+        max_load = f;
+    }
+
+    mapped_type *find(key_type key) {
+        int s = special_of(key);
+        if (s >= 0)
+            return special_full[s] ? &special_values[s] : nullptr;
+        size_type i = locate(key, hash_of(key));
+        return i == npos ? nullptr : &value_at(i);
+    }
+
+    const mapped_type *find(key_type key) const {
+        return const_cast<flat_map *>(this)->find(key);
+    }
+
+    bool contains(key_type key) const {
+        return find(key) != nullptr;
+    }
+
+    mapped_type &at(key_type key) {
+        mapped_type *value = find(key);
+        if (value == nullptr)
+            throw std::out_of_range("item not found");
+        return *value;
+    }
+
+    const mapped_type &at(key_type key) const {
+        return const_cast<flat_map *>(this)->at(key);
+    }
+
+    /// Returns false and leaves the map unchanged when @a key is already present.
+    bool insert(key_type key, const mapped_type &value) {
+        return write(key, value, false);
+    }
+
+    /// Inserts or overwrites; returns true when the key was new.
+    bool insert_or_assign(key_type key, const mapped_type &value) {
+        return write(key, value, true);
+    }
+
+    bool erase(key_type key) {
+        int s = special_of(key);
+        if (s >= 0) {
+            if (!special_full[s])
+                return false;
+            special_full[s] = false;
+            --size_;
+            return true;
+        }
+        size_type i = locate(key, hash_of(key));
+        if (i == npos)
+            return false;
+        slot_key(i) = deleted_key;
+        --size_;
+        ++tombstones;
+        return true;
+    }
+
+    void reserve(size_type n) {
+        if (groups_for(n) > groups)
+            rebuild(groups_for(n));
+    }
+
+    /// Calls fn(key, value) for every element.
+    template<typename F>
+    void for_each(F fn) const {
+        for (size_type i = 0; i < bucket_count(); ++i) {
+            K key = const_cast<flat_map *>(this)->slot_key(i);
+            if (key != empty_key && key != deleted_key)
+                fn(key, const_cast<flat_map *>(this)->value_at(i));
+        }
+        if (special_full[0])
+            fn(empty_key, special_values[0]);
+        if (special_full[1])
+            fn(deleted_key, special_values[1]);
+    }
+
+    void swap(flat_map &other) noexcept {
+        std::swap(blocks, other.blocks);
+        std::swap(groups, other.groups);
+        std::swap(size_, other.size_);
+        std::swap(tombstones, other.tombstones);
+        std::swap(max_load, other.max_load);
+        std::swap(special_full, other.special_full);
+        std::swap(special_values, other.special_values);
+        std::swap(hasher_, other.hasher_);
+    }
+
+private:
+    static constexpr bool stores_values = !std::is_empty<T>::value;
+
+    struct keys_only_block {
+        K keys[width];
+    };
+
+    struct inline_block {
+        K keys[width];
+        T values[width];
+    };
+
+    using block_layout = typename std::conditional<stores_values, inline_block, keys_only_block>::type;
+
+    static constexpr std::size_t block_align = (sizeof(block_layout) & (sizeof(block_layout) - 1)) == 0 &&
+                                               sizeof(block_layout) <= 64 ? sizeof(block_layout) : ctrl_group::width;
+
+    struct alignas(block_align) key_block : block_layout {
+    };
+
+    static constexpr size_type npos = static_cast<size_type>(-1);
+
+    std::unique_ptr<key_block[]> blocks;
+    size_type groups = 0, size_ = 0, tombstones = 0;
+    float max_load = load_limit;
+    /// Presence and values of empty_key and deleted_key, which cannot go in the table.
+    bool special_full[2] = {false, false};
+    T special_values[2] = {};
+    Hash hasher_;
+
+    size_type groups_for(size_type n) const {
+        size_type slots = static_cast<size_type>(std::ceil(n / max_load)) + 1;
+        return std::max<size_type>(1, (slots + width - 1) / width);
+    }
+
+    void allocate(size_type n) {
+        blocks.reset(new key_block[n]);
+        for (size_type g = 0; g < n; ++g)
+            std::fill(blocks[g].keys, blocks[g].keys + width, empty_key);
+        groups = n;
+        size_ = tombstones = 0;
+        special_full[0] = special_full[1] = false;
+    }
+
+    /// 0 for empty_key, 1 for deleted_key, -1 for keys that go in the table.
+    static int special_of(key_type key) {
+        return key == empty_key ? 0 : key == deleted_key ? 1 : -1;
+    }
+
+    size_t hash_of(key_type key) const {
+        size_t hash = hasher_(key);
+        return is_avalanching<Hash>::value ? hash : mix_hash(hash);
+    }
+
+    K &slot_key(size_type i) {
+        return blocks[i / width].keys[i % width];
+    }
+
+    mapped_type &value_at(size_type i) {
+        if constexpr (stores_values)
+            return blocks[i / width].values[i % width];
+        else
+            return special_values[0];
+    }
+
+    size_type table_size() const {
+        return size_ - special_full[0] - special_full[1];
+    }
+
+    size_type locate(key_type key, size_t hash) const {
+        size_type g = fastrange_index::index(hash, groups);
+        for (size_type probed = 0; probed < groups; ++probed) {
+            key_group<K> group(blocks[g].keys);
+            uint32_t mask = group.match(key);
+            if (mask != 0)
+                return g * width + key_group<K>::slot(mask);
+            if (group.match(empty_key) != 0)
+                return npos;
+            g = g + 1 == groups ? 0 : g + 1;
+        }
+        return npos;
+    }
+
+    /// Puts an absent key into the first empty or deleted slot on its probe path.
+    void place(key_type key, const mapped_type &value, size_t hash) {
+        size_type g = fastrange_index::index(hash, groups);
+        while (true) {
+            key_group<K> group(blocks[g].keys);
+            uint32_t mask = group.match(empty_key) | group.match(deleted_key);
+            if (mask != 0) {
+                size_type i = g * width + key_group<K>::slot(mask);
+                if (slot_key(i) == deleted_key)
+                    --tombstones;
+                slot_key(i) = key;
+                value_at(i) = value;
+                ++size_;
+                return;
+            }
+            g = g + 1 == groups ? 0 : g + 1;
+        }
+    }
+
+    bool write(key_type key, const mapped_type &value, bool assign) {
+        int s = special_of(key);
+        if (s >= 0) {
+            bool inserted = !special_full[s];
+            if (inserted || assign)
+                special_values[s] = value;
+            special_full[s] = true;
+            size_ += inserted;
+            return inserted;
+        }
+        size_t hash = hash_of(key);
+        size_type i = locate(key, hash);
+        if (i != npos) {
+            if (assign)
+                value_at(i) = value;
+            return false;
+        }
+        if (table_size() + tombstones + 1 > max_load * bucket_count())
+            rebuild(table_size() + 1 > max_load * bucket_count() / 2 ? groups * 2 : groups);
+        place(key, value, hash);
+        return true;
+    }
+
+    /// Copies the live slots into a fresh table of @a n groups, which is the
+    /// current size when most of the load was tombstones.
+    void rebuild(size_type n) {
+        flat_map bigger;
+        bigger.hasher_ = hasher_;
+        bigger.max_load = max_load;
+        bigger.allocate(n);
+        for (size_type i = 0; i < bucket_count(); ++i) {
+            K key = slot_key(i);
+            if (key != empty_key && key != deleted_key)
+                bigger.place(key, value_at(i), bigger.hash_of(key));
+        }
+        bigger.special_full[0] = special_full[0];
+        bigger.special_full[1] = special_full[1];
+        bigger.special_values[0] = special_values[0];
+        bigger.special_values[1] = special_values[1];
+        bigger.size_ = size_;
+        swap(bigger);
+    }
+};
+
+/// Set counterpart of flat_map: the same key array with no values beside it.
+template<typename K, typename Hash = std::hash<K>>
+class flat_set {
+public:
+    using key_type = K;
+    using size_type = std::size_t;
+
+    flat_set() = default;
+
+    explicit flat_set(size_type n) : map_(n) {}
+
+    size_type size() const noexcept {
+        return map_.size();
+    }
+
+    bool empty() const noexcept {
+        return map_.empty();
+    }
+
+    size_type bucket_count() const noexcept {
+        return map_.bucket_count();
+    }
+
+    float load_factor() const noexcept {
+        return map_.load_factor();
+    }
+
+    float max_load_factor() const noexcept {
+        return map_.max_load_factor();
+    }
+
+    void max_load_factor(float f) {
+        map_.max_load_factor(f);
+    }
+
+    bool contains(key_type key) const {
+        return map_.contains(key);
+    }
+
+    /// Returns false when @a key was already present.
+    bool insert(key_type key) {
+        return map_.insert(key, no_value());
+    }
+
+    bool erase(key_type key) {
+        return map_.erase(key);
+    }
+
+    void reserve(size_type n) {
+        map_.reserve(n);
+    }
+
+    /// Calls fn(key) for every element.
+    template<typename F>
+    void for_each(F fn) const {
+        map_.for_each([&fn](key_type key, no_value) { fn(key); });
+    }
+
+    void swap(flat_set &other) noexcept {
+        map_.swap(other.map_);
+    }
+
+private:
+    flat_map<K, no_value, Hash> map_;
+};
+
+#if defined(__linux__)
+
+/**
+ *  @brief  hash_map whose table lives in a file, so a process can reopen a
+ *          large map in O(1) instead of rebuilding it with insert.
+ *
+ *  The file is a versioned header followed by the control bytes and the
+ *  slots, probed in aligned groups like read_mostly_hash_map. Opening maps
+ *  the file without reading it; pages come in as lookups touch them.
+ *  A read_only map can be opened by any number of processes at once.
+ *
+ *  Keys and values must be trivially copyable, and Hash must give the same
+ *  result in every process that opens the file. The header records the
+ *  slot layout and the control-group width, and open() rejects files
+ *  written by a build that disagrees on either.
+ */
+template<typename K, typename T,
+        typename Hash = std::hash<K>,
+        typename Pred = std::equal_to<K>>
+class mapped_hash_map {
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                  "mapped_hash_map stores slots in a file and needs trivially copyable types");
+public:
+    using key_type = K;
+    using mapped_type = T;
+    using size_type = std::size_t;
+
+    enum class access {
+        read_only, read_write
+    };
+
+    static constexpr uint32_t format_version = 1;
+
+    mapped_hash_map(const mapped_hash_map &) = delete;
+
+    mapped_hash_map &operator=(const mapped_hash_map &) = delete;
+
+    mapped_hash_map(mapped_hash_map &&other) noexcept {
+        swap(other);
+    }
+
+    mapped_hash_map &operator=(mapped_hash_map &&other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~mapped_hash_map() {
+        unmap();
+    }
+
+    /// Creates (or truncates) @a path with room for @a n elements.
+    static mapped_hash_map create(const std::string &path, size_type n) {
+        size_type groups = 1;
+        while (groups * ctrl_group::width * max_load_num < n * max_load_den)
+            groups *= 2;
+        mapped_hash_map map;
+        map.path_ = path;
+        map.writable = true;
+        map.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (map.fd < 0)
+            fail("cannot create", path);
+        size_type bytes = file_size(groups);
+        if (ftruncate(map.fd, static_cast<off_t>(bytes)) != 0)
+            fail("cannot resize", path);
+        map.map_file(bytes);
+        header &h = *map.head;
+        std::memcpy(h.magic, magic, sizeof(h.magic));
+        h.version = format_version;
+        h.group_width = ctrl_group::width;
+        h.key_size = sizeof(K);
+        h.mapped_size = sizeof(T);
+        h.slot_size = sizeof(slot);
+        h.slot_align = alignof(slot);
+        h.groups = groups;
+        std::memset(map.ctrl(), EMPTY, groups * ctrl_group::width);
+        return map;
+    }
+
+    /// Maps an existing file. Nothing beyond the header is read.
+    static mapped_hash_map open(const std::string &path, access mode = access::read_only) {
+        mapped_hash_map map;
+        map.path_ = path;
+        map.writable = mode == access::read_write;
+        map.fd = ::open(path.c_str(), map.writable ? O_RDWR : O_RDONLY);
+        if (map.fd < 0)
+            fail("cannot open", path);
+        struct stat st{};
+        if (fstat(map.fd, &st) != 0 || static_cast<size_type>(st.st_size) < sizeof(header))
+            fail("not a hash map file:", path);
+        map.map_file(static_cast<size_type>(st.st_size));
+        const header &h = *map.head;
+        if (std::memcmp(h.magic, magic, sizeof(h.magic)) != 0 || h.version != format_version ||
+            h.group_width != ctrl_group::width || h.key_size != sizeof(K) || h.mapped_size != sizeof(T) ||
+            h.slot_size != sizeof(slot) || h.slot_align != alignof(slot) || file_size(h.groups) != map.bytes)
+            throw std::runtime_error("incompatible hash map file: " + path);
+        madvise(map.base, map.bytes, MADV_RANDOM);
+        return map;
+    }
+
+    size_type size() const noexcept {
+        return head->size;
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    size_type bucket_count() const noexcept {
+        return head->groups * ctrl_group::width;
+    }
+
+    /// Pointer to the value of @a key inside the mapping, nullptr when absent.
+    const mapped_type *find(const key_type &key) const {
+        size_type i = locate(key, hash_of(key));
+        return i == bucket_count() ? nullptr : &slots()[i].value;
+    }
+
+    bool contains(const key_type &key) const {
+        return find(key) != nullptr;
+    }
+
+    const mapped_type &at(const key_type &key) const {
+        const mapped_type *value = find(key);
+        if (value == nullptr)
+            throw std::out_of_range("item not found");
+        return *value;
+    }
+
+    /// Inserts unless @a key is present; returns whether it did.
+    bool insert(const key_type &key, const mapped_type &value) {
+        return write(key, value, false);
+    }
+
+    /// Inserts or overwrites; returns true when the key was new.
+    bool insert_or_assign(const key_type &key, const mapped_type &value) {
+        return write(key, value, true);
+    }
+
+    bool erase(const key_type &key) {
+        require_writable();
+        size_type i = locate(key, hash_of(key));
+        if (i == bucket_count())
+            return false;
+        ctrl()[i] = DELETED;
+        --head->size;
+        ++head->tombstones;
+        return true;
+    }
+
+    /// Writes dirty pages back to the file.
+    void flush() {
+        if (writable && msync(base, bytes, MS_SYNC) != 0)
+            fail("cannot sync", path_);
+    }
+
+    void swap(mapped_hash_map &other) noexcept {
+        std::swap(path_, other.path_);
+        std::swap(fd, other.fd);
+        std::swap(base, other.base);
+        std::swap(bytes, other.bytes);
+        std::swap(head, other.head);
+        std::swap(writable, other.writable);
+        std::swap(hasher_, other.hasher_);
+        std::swap(equal_, other.equal_);
+    }
+
+private:
+    struct slot {
+        K key;
+        T value;
+    };
+
+    /// Fixed-size file header; the tables start at the next 64-byte boundary.
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t group_width;
+        uint32_t key_size;
+        uint32_t mapped_size;
+        uint32_t slot_size;
+        uint32_t slot_align;
+        uint64_t groups;
+        uint64_t size;
+        uint64_t tombstones;
+    };
+
+    static constexpr char magic[8] = {'H', 'A', 'S', 'H', 'M', 'A', 'P', '\0'};
+    static constexpr size_type max_load_num = 7, max_load_den = 8;
+    static constexpr size_type table_offset = 64;
+    static_assert(sizeof(header) <= table_offset, "the header must fit before the tables");
+
+    std::string path_;
+    int fd = -1;
+    void *base = nullptr;
+    size_type bytes = 0;
+    header *head = nullptr;
+    bool writable = false;
+    Hash hasher_;
+    Pred equal_;
+
+    mapped_hash_map() = default;
+
+    [[noreturn]] static void fail(const char *what, const std::string &path) {
+        throw std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(errno));
+    }
+
+    static size_type slots_offset(size_type groups) {
+        size_type offset = table_offset + groups * ctrl_group::width;
+        return (offset + alignof(slot) - 1) / alignof(slot) * alignof(slot);
+    }
+
+    static size_type file_size(size_type groups) {
+        return slots_offset(groups) + groups * ctrl_group::width * sizeof(slot);
+    }
+
+    ctrl_t *ctrl() const {
+        return reinterpret_cast<ctrl_t *>(static_cast<char *>(base) + table_offset);
+    }
+
+    slot *slots() const {
+        return reinterpret_cast<slot *>(static_cast<char *>(base) + slots_offset(head->groups));
+    }
+
+    void map_file(size_type size) {
+        bytes = size;
+        base = mmap(nullptr, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            base = nullptr;
+            fail("cannot map", path_);
+        }
+        head = static_cast<header *>(base);
+    }
+
+    void unmap() {
+        if (base != nullptr)
+            munmap(base, bytes);
+        if (fd >= 0)
+            ::close(fd);
+        base = nullptr;
+        head = nullptr;
+        fd = -1;
+    }
+
+    void require_writable() const {
+        if (!writable)
+            throw std::logic_error("mapped_hash_map opened read-only: " + path_);
+    }
+
+    size_t hash_of(const key_type &key) const {
+        size_t hash = hasher_(key);
+        return is_avalanching<Hash>::value ? hash : mix_hash(hash);
+    }
+
+    size_type locate(const key_type &key, size_t hash) const {
+        const size_type groups = head->groups;
+        ctrl_t tag = fastrange_index::tag(hash);
+        size_type g = fastrange_index::index(hash, groups);
+        for (size_type probed = 0; probed < groups; ++probed) {
+            const size_type base_index = g * ctrl_group::width;
+            ctrl_group group(ctrl() + base_index);
+            for (uint32_t mask = group.match(tag); mask != 0; mask &= mask - 1) {
+                if (equal_(slots()[base_index + lowest_bit(mask)].key, key))
+                    return base_index + lowest_bit(mask);
+            }
+            if (group.match_empty() != 0)
+                return bucket_count();
+            g = g + 1 == groups ? 0 : g + 1;
+        }
+        return bucket_count();
+    }
+
+    /// Puts an absent key into the first group with an empty or deleted slot.
+    void place(const slot &s, size_t hash) {
+        size_type g = fastrange_index::index(hash, head->groups);
+        while (true) {
+            const size_type base_index = g * ctrl_group::width;
+            uint32_t mask = ctrl_group(ctrl() + base_index).match_empty_or_deleted();
+            if (mask != 0) {
+                size_type i = base_index + lowest_bit(mask);
+                if (ctrl()[i] == DELETED)
+                    --head->tombstones;
+                slots()[i] = s;
+                ctrl()[i] = fastrange_index::tag(hash);
+                ++head->size;
+                return;
+            }
+            g = g + 1 == head->groups ? 0 : g + 1;
+        }
+    }
+
+    bool write(const key_type &key, const mapped_type &value, bool assign) {
+        require_writable();
+        size_t hash = hash_of(key);
+        size_type i = locate(key, hash);
+        if (i != bucket_count()) {
+            if (assign)
+                slots()[i].value = value;
+            return false;
+        }
+        if ((head->size + head->tombstones + 1) * max_load_den > bucket_count() * max_load_num)
+            rebuild();
+        place(slot{key, value}, hash);
+        return true;
+    }
+
+    /// Copies the live slots into a new file next to this one (twice as large
+    /// unless most of the load was tombstones) and renames it over the original.
+    void rebuild() {
+        size_type n = head->size + 1;
+        if (n * max_load_den * 2 > bucket_count() * max_load_num)
+            n = bucket_count() * 2 * max_load_num / max_load_den;
+        mapped_hash_map bigger = create(path_ + ".rebuild", n);
+        bigger.hasher_ = hasher_;
+        bigger.equal_ = equal_;
+        for (size_type i = 0; i < bucket_count(); ++i) {
+            if (is_full(ctrl()[i]))
+                bigger.place(slots()[i], bigger.hash_of(slots()[i].key));
+        }
+        bigger.flush();
+        if (std::rename(bigger.path_.c_str(), path_.c_str()) != 0)
+            fail("cannot replace", path_);
+        bigger.path_ = path_;
+        swap(bigger);
+    }
+};
+
+#endif
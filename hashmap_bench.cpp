@@ -0,0 +1,275 @@
+#include "hash_map.h"
+
+#include <random>
+#include <unordered_map>
+
+#include <benchmark/benchmark.h>
+
+#if defined(HASHMAP_BENCH_ABSL)
+#include <absl/container/flat_hash_map.h>
+#endif
+
+/**
+ *  Performance suite for hash_map against std::unordered_map (and
+ *  absl::flat_hash_map when CMake finds abseil).
+ *
+ *  Every benchmark is named <operation>/<map>/<key>/size:<n>[/load:<percent>] and
+ *  reports items per second. Sizes run from a table that fits in L1 to one
+ *  far larger than the last-level cache. For a file that can be tracked
+ *  over time run
+ *
+ *      ./hashmap_bench --benchmark_out=bench.json --benchmark_out_format=json
+ *
+ *  and pick a subset with --benchmark_filter, e.g. '^find_hit.+uint64'.
+ */
+
+namespace {
+
+using mapped = uint64_t;
+
+/// Key generators: make(i) is distinct for every i, and keys for i >= n are
+/// the misses of a table holding the first n.
+struct int_keys {
+    using type = int;
+    static constexpr const char *name = "int";
+    static constexpr std::size_t max_size = 1 << 22;
+
+    static type make(uint64_t i) {
+        return static_cast<type>(static_cast<uint32_t>(i) * 0x9E3779B1u);
+    }
+};
+
+struct uint64_keys {
+    using type = uint64_t;
+    static constexpr const char *name = "uint64";
+    static constexpr std::size_t max_size = 1 << 22;
+
+    static type make(uint64_t i) {
+        return i * 0x9E3779B97F4A7C15ull;
+    }
+};
+
+/// Strings of exactly Length characters: the index in hex, padded.
+template<std::size_t Length>
+struct string_keys {
+    using type = std::string;
+    static constexpr std::size_t max_size = 1 << 19;
+    static const std::string name;
+
+    static type make(uint64_t i) {
+        char digits[17];
+        std::snprintf(digits, sizeof(digits), "%016llx",
+                      static_cast<unsigned long long>(i * 0x9E3779B97F4A7C15ull));
+        std::string key(Length, '.');
+        key.replace(Length > 16 ? Length - 16 : 0, std::min<std::size_t>(16, Length),
+                    digits + (Length < 16 ? 16 - Length : 0));
+        return key;
+    }
+};
+
+template<std::size_t Length>
+const std::string string_keys<Length>::name = "string" + std::to_string(Length);
+
+template<typename Keys>
+std::vector<typename Keys::type> make_keys(uint64_t first, std::size_t n) {
+    std::vector<typename Keys::type> keys;
+    keys.reserve(n);
+    for (uint64_t i = first; i < first + n; ++i)
+        keys.push_back(Keys::make(i));
+    return keys;
+}
+
+/// Same keys in a random order, so lookups do not walk the table in insertion order.
+template<typename Key>
+std::vector<Key> shuffled(std::vector<Key> keys) {
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+    return keys;
+}
+
+/// Presized for @a n elements at @a load percent of its buckets, with the
+/// maximum load factor raised where needed so it does not grow first.
+template<typename Map>
+Map make_map(std::size_t n, int load) {
+    Map map(std::max<std::size_t>(1, n * 100 / load));
+    if (load / 100.0f > map.max_load_factor())
+        map.max_load_factor(0.9f);
+    return map;
+}
+
+template<typename Map, typename Key>
+Map filled(const std::vector<Key> &keys, int load) {
+    Map map = make_map<Map>(keys.size(), load);
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        map.emplace(keys[i], mapped(i));
+    return map;
+}
+
+template<typename Map, typename Keys>
+void insert(benchmark::State &state) {
+    const std::size_t n = state.range(0);
+    auto keys = make_keys<Keys>(0, n);
+    for (auto _ : state) {
+        Map map;
+        for (std::size_t i = 0; i < n; ++i)
+            map.emplace(keys[i], mapped(i));
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+/// Looks up n keys in a table filled to the requested load. n is taken
+/// from the bucket count the map really allocated, which can differ from
+/// the one requested: std::unordered_map rounds to a prime, and hash_map
+/// rounds to a power of two under pow2_index.
+template<typename Map, typename Keys>
+void lookup(benchmark::State &state, bool hit) {
+    const int load = static_cast<int>(state.range(1));
+    const std::size_t n = make_map<Map>(state.range(0), load).bucket_count() * load / 100;
+    auto keys = make_keys<Keys>(0, n);
+    const Map map = filled<Map>(keys, load);
+    auto probes = shuffled(hit ? keys : make_keys<Keys>(n, n));
+    std::size_t found = 0;
+    for (auto _ : state) {
+        for (const auto &key : probes)
+            found += map.find(key) != map.end();
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<typename Map, typename Keys>
+void find_hit(benchmark::State &state) {
+    lookup<Map, Keys>(state, true);
+}
+
+template<typename Map, typename Keys>
+void find_miss(benchmark::State &state) {
+    lookup<Map, Keys>(state, false);
+}
+
+template<typename Map, typename Keys>
+void erase(benchmark::State &state) {
+    const std::size_t n = state.range(0);
+    auto keys = make_keys<Keys>(0, n);
+    const Map full = filled<Map>(keys, 50);
+    keys = shuffled(keys);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Map map(full);
+        state.ResumeTiming();
+        for (const auto &key : keys)
+            map.erase(key);
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<typename Map, typename Keys>
+void iterate(benchmark::State &state) {
+    const std::size_t n = state.range(0);
+    const Map map = filled<Map>(make_keys<Keys>(0, n), 50);
+    for (auto _ : state) {
+        mapped sum = 0;
+        for (const auto &element : map)
+            sum += element.second;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+/// Doubles the bucket count of a table holding n elements.
+template<typename Map, typename Keys>
+void rehash(benchmark::State &state) {
+    const std::size_t n = state.range(0);
+    const Map full = filled<Map>(make_keys<Keys>(0, n), 50);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Map map(full);
+        state.ResumeTiming();
+        map.rehash(map.bucket_count() * 2);
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+/// Steady state at n elements: 80% hits, 10% erases each followed by an
+/// insert of a new key, so the size stays put.
+template<typename Map, typename Keys>
+void mixed(benchmark::State &state) {
+    const std::size_t n = state.range(0);
+    auto keys = make_keys<Keys>(0, n);
+    Map map = filled<Map>(keys, 50);
+    std::mt19937_64 rng(7);
+    std::vector<uint32_t> ops(1 << 16);
+    for (auto &op : ops)
+        op = static_cast<uint32_t>(rng());
+    uint64_t next = n;
+    std::size_t found = 0, step = 0;
+    for (auto _ : state) {
+        uint32_t op = ops[step++ & (ops.size() - 1)];
+        std::size_t slot = (static_cast<uint64_t>(op >> 4) * n) >> 28;
+        if (op % 10 < 8) {
+            found += map.find(keys[slot]) != map.end();
+        } else {
+            map.erase(keys[slot]);
+            keys[slot] = Keys::make(next++);
+            map.emplace(keys[slot], mapped(slot));
+        }
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Keys>
+std::vector<int64_t> sizes() {
+    std::vector<int64_t> result;
+    for (std::size_t n = 1 << 10; n <= Keys::max_size; n *= 8)
+        result.push_back(static_cast<int64_t>(n));
+    return result;
+}
+
+template<typename Map, typename Keys>
+void register_map(const std::string &map_name) {
+    const std::string suffix = "/" + map_name + "/" + std::string(Keys::name);
+    auto sized = [&suffix](const char *operation, void (*fn)(benchmark::State &)) {
+        benchmark::RegisterBenchmark((operation + suffix).c_str(), fn)
+                ->ArgNames({"size"})->ArgsProduct({sizes<Keys>()});
+    };
+    auto loaded = [&suffix](const char *operation, void (*fn)(benchmark::State &)) {
+        benchmark::RegisterBenchmark((operation + suffix).c_str(), fn)
+                ->ArgNames({"size", "load"})->ArgsProduct({sizes<Keys>(), {25, 50, 75, 87}});
+    };
+    sized("insert", insert<Map, Keys>);
+    loaded("find_hit", find_hit<Map, Keys>);
+    loaded("find_miss", find_miss<Map, Keys>);
+    sized("erase", erase<Map, Keys>);
+    sized("iterate", iterate<Map, Keys>);
+    sized("rehash", rehash<Map, Keys>);
+    sized("mixed", mixed<Map, Keys>);
+}
+
+template<typename Keys>
+void register_maps() {
+    using K = typename Keys::type;
+    register_map<hash_map<K, mapped>, Keys>("hash_map");
+    register_map<std::unordered_map<K, mapped>, Keys>("std::unordered_map");
+#if defined(HASHMAP_BENCH_ABSL)
+    register_map<absl::flat_hash_map<K, mapped>, Keys>("absl::flat_hash_map");
+#endif
+}
+
+}
+
+int main(int argc, char **argv) {
+    register_maps<int_keys>();
+    register_maps<uint64_keys>();
+    register_maps<string_keys<8>>();
+    register_maps<string_keys<32>>();
+    register_maps<string_keys<128>>();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,612 +1,2038 @@
-#include <iostream>
-#include <string>
-#include <functional>
-#include <memory>
-#include <utility>
-#include <type_traits>
-#include <vector>
-#include <limits>
-#include <cmath>
+#include "hash_map.h"
 
+#include <unordered_map>
+#include <random>
+#include <sstream>
+#include <set>
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
 
 using namespace std;
 
-enum status {
-    DELETED,
-    EMPTY,
-    FULL
-};
+///////////////////////////////////////////
 
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#define CATCH_CONFIG_ENABLE_BENCHMARKING  // benchmarks are tagged [.] and only run on request: ./untitled1 [benchmark]
+#include "catch.hpp"
 
-template<typename T>
-class My_allocator {
-public:
-    using size_type = std::size_t;
-    using difference_type = std::ptrdiff_t;
-    using pointer = T *;
-    using const_pointer = const T *;
-    using reference = typename std::add_lvalue_reference<T>::type;
-    using const_reference = typename std::add_lvalue_reference<const T>::type;
-    using value_type = T;
+TEST_CASE("LAB2") {
+SECTION("") {
+allocator<int> alloc;
+int *place = alloc.allocate(15);
+REQUIRE(*place == 15);
+}
+SECTION("") {
+allocator<int> alloc;
+int *data = alloc.allocate(50);
+alloc.deallocate(data, 50);
+}
+SECTION("") {
+hash_map<int, int>
+        table({{21, 1},
+               {0, 23},
+               {2, 3},
+               {-1, 11},
+               {-12, 11},
+               {21, 1}});
+hash_map<int, int> other_table(table.get_allocator());
+// table.insert(std::make_pair(7, 1));
+// table.insert(std::make_pair(2, 2));
+// table.insert(std::make_pair(3, 3));
+}
 
-    My_allocator() noexcept = default;
+SECTION("") {
+hash_map<std::string, int> table(7);
+REQUIRE(table.bucket_count() == 7);
+REQUIRE(table.size() == 0);
+REQUIRE(table.empty());
+}
+SECTION("") {
+hash_map<std::string, int> table;
+REQUIRE(table.bucket_count() == 0);
+REQUIRE(table.size() == 0);
+REQUIRE(table.empty());
+REQUIRE(table.load_factor() == 0);
+}
+SECTION("") {
+hash_map<std::string, int> table(2);
+std::pair<std::string, int> element{"yes", 1};
+// table.insert(element);
+// REQUIRE(table.begin()->first == "yes");
+// REQUIRE(table.begin()->second == 1);
+}
+SECTION("") {
+std::vector<std::pair<std::string, int>> elements(9);
+elements[0] = {"death", 1};
+elements[1] = {"rest", 2};
+elements[2] = {"in", 3};
+elements[3] = {"peace", 4};
+elements[4] = {"help", 5};
+// fefu::hash_map<std::string, int> table(elements.begin(), elements.end());
+// std::cout « table.contains("death");
+}
+//SECTION("") {
+//hash_map<std::string, int> table
+//        ({{"death", 1}, {"rest", 23}, {"help", 3}, {"my", 11}, {"give", 11}});
+//REQUIRE(table.cbegin() == table.cend());
+//}
+SECTION("") {
+hash_map<int, int> table(10);
+table[6] = -120;
+table[2] = 12;
+REQUIRE(table[6] == -120);
+REQUIRE(table[2] == 12);
+}
+}
 
-    My_allocator(const My_allocator &) noexcept = default;
+TEST_CASE("control bytes and group probing") {
+SECTION("find hits and misses") {
+hash_map<int, int> table;
+for (int i = 0; i < 1000; ++i)
+    table.insert(i, i * 2);
+REQUIRE(table.size() == 1000);
+for (int i = 0; i < 1000; ++i) {
+    REQUIRE(table.find(i) != table.end());
+    REQUIRE(table.find(i)->second == i * 2);
+}
+for (int i = 1000; i < 2000; ++i)
+    REQUIRE(table.find(i) == table.end());
+}
+SECTION("duplicate insert keeps the first value") {
+hash_map<std::string, int> table;
+REQUIRE(table.insert("a", 1).second);
+REQUIRE_FALSE(table.insert("a", 2).second);
+REQUIRE(table.find("a")->second == 1);
+REQUIRE(table.size() == 1);
+}
+SECTION("erase leaves the rest reachable") {
+hash_map<int, int> table;
+for (int i = 0; i < 500; ++i)
+    table.insert(i, i);
+for (int i = 0; i < 500; i += 2)
+    table.erase(i);
+REQUIRE(table.size() == 250);
+for (int i = 0; i < 500; ++i)
+    REQUIRE((table.find(i) != table.end()) == (i % 2 == 1));
+for (int i = 0; i < 500; i += 2)
+    REQUIRE(table.insert(i, -i).second);
+REQUIRE(table.find(42)->second == -42);
+}
+SECTION("tables smaller than a group") {
+hash_map<int, int> table(2);
+table.insert(7, 1);
+table.insert(9, 2);
+REQUIRE(table.find(7)->second == 1);
+REQUIRE(table.find(9)->second == 2);
+REQUIRE(table.find(11) == table.end());
+}
+SECTION("clear resets the control bytes") {
+hash_map<int, int> table;
+for (int i = 0; i < 100; ++i)
+    table.insert(i, i);
+table.clear();
+REQUIRE(table.empty());
+REQUIRE(table.find(5) == table.end());
+}
+}
 
-    template<class U>
-    explicit My_allocator(const My_allocator<U> &) noexcept {}
+TEST_CASE("iterators are views") {
+SECTION("find returns an iterator into the table") {
+hash_map<int, int> table;
+table.insert(1, 10);
+auto it = table.find(1);
+it->second = 11;
+REQUIRE(table.find(1)->second == 11);
+hash_map_const_iterator<std::pair<const int, int>> cit = it;
+REQUIRE(cit->second == 11);
+}
+SECTION("const find and at") {
+hash_map<int, int> table;
+table.insert(3, 30);
+const hash_map<int, int> &ref = table;
+REQUIRE(ref.find(3) != ref.end());
+REQUIRE(ref.find(4) == ref.end());
+REQUIRE(ref.at(3) == 30);
+REQUIRE_THROWS_AS(ref.at(4), std::out_of_range);
+}
+}
 
-    ~My_allocator() = default;
+TEST_CASE("find cost does not depend on bucket_count", "[.][benchmark]") {
+for (size_t buckets : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 22}) {
+hash_map<int, int> table(buckets);
+for (int i = 0; i < 256; ++i)
+    table.insert(i, i);
+BENCHMARK("find, bucket_count = " + std::to_string(table.bucket_count())) {
+    long sum = 0;
+    for (int i = 0; i < 256; ++i)
+        sum += table.find(i)->second;
+    return sum;
+};
+}
+}
 
-    pointer allocate(size_type n) {
-        return static_cast<pointer>(::operator new(sizeof(T) * n));
-    }
+TEST_CASE("iteration resumes from the current slot") {
+SECTION("every element is visited exactly once") {
+hash_map<int, int> table;
+for (int i = 0; i < 10000; ++i)
+    table.insert(i, i);
+for (int i = 0; i < 10000; i += 3)
+    table.erase(i);
+std::vector<int> seen;
+for (auto it = table.begin(); it != table.end(); ++it)
+    seen.push_back(it->first);
+std::sort(seen.begin(), seen.end());
+REQUIRE(seen.size() == table.size());
+REQUIRE(std::adjacent_find(seen.begin(), seen.end()) == seen.end());
+for (int key : seen)
+    REQUIRE(key % 3 != 0);
+}
+SECTION("const iteration and empty tables") {
+hash_map<int, int> empty;
+REQUIRE(empty.begin() == empty.end());
+hash_map<int, int> table(40);
+table.insert(39, 1);
+table.insert(0, 2);
+const hash_map<int, int> &ref = table;
+int count = 0, sum = 0;
+for (auto it = ref.cbegin(); it != ref.cend(); it++) {
+    ++count;
+    sum += it->second;
+}
+REQUIRE(count == 2);
+REQUIRE(sum == 3);
+}
+}
 
-    void deallocate(pointer p, size_type n) noexcept {
-        ::operator delete(p, n * sizeof(value_type));
+TEST_CASE("incremental rehash") {
+using incremental_map = hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, incremental_rehash_policy>;
+SECTION("lookups see both tables while a resize is in progress") {
+incremental_map table;
+for (int i = 0; i < 20000; ++i) {
+    table.insert(i, i + 1);
+    if (i % 97 == 0) {
+        for (int j = 0; j <= i; j += 13)
+            REQUIRE(table.find(j)->second == j + 1);
     }
-};
+}
+REQUIRE(table.size() == 20000);
+for (int i = 0; i < 20000; ++i)
+    REQUIRE(table.at(i) == i + 1);
+}
+SECTION("erase and iterate during a resize") {
+incremental_map table;
+int inserted = 0;
+while (table.bucket_count() < 1000 || table.bucket_count() == 1536)
+    table.insert(inserted, inserted), ++inserted;
+for (int i = 0; i < inserted; i += 2)
+    table.erase(i);
+int count = 0;
+long sum = 0;
+for (auto it = table.begin(); it != table.end(); ++it) {
+    ++count;
+    sum += it->first;
+}
+REQUIRE(count == static_cast<int>(table.size()));
+long expected = 0;
+for (int i = 1; i < inserted; i += 2)
+    expected += i;
+REQUIRE(sum == expected);
+}
+SECTION("copying a map mid-resize through merge") {
+incremental_map table;
+for (int i = 0; i < 3000; ++i)
+    table.insert(i, i);
+incremental_map other;
+other.merge(table);
+REQUIRE(other.size() == 3000);
+table.clear();
+REQUIRE(table.empty());
+REQUIRE(table.begin() == table.end());
+}
+}
 
-template<typename K, typename T,
-        typename Hash = std::hash<K>,
-        typename Pred = std::equal_to<K>,
-        typename Alloc = My_allocator<std::pair<const K, T>>>
-class hash_map;
-
-template<typename ValueType>
-class hash_map_iterator {
-private:
-    ValueType *p;
-    int capacity = 0;
-    vector<status> status_;
-    int hash_index = 0;
-public:
-    using iterator_category = std::forward_iterator_tag;
-    using value_type = ValueType;
-    using difference_type = std::ptrdiff_t;
-    using reference = ValueType &;
-    using pointer = ValueType *;
-
-    template<typename K, typename T,
-            typename Hash,
-            typename Pred,
-            typename Alloc>
-    friend
-    class hash_map;
-
-    hash_map_iterator() = default;
-
-    hash_map_iterator(pointer p, int capacity, vector<status> status_, int hash_index) :
-            p(p), capacity(capacity),
-            status_(status_),
-            hash_index(hash_index) {}
-
-    hash_map_iterator(const hash_map_iterator &other) noexcept {
-        this->p = other.p;
-        this->capacity = other.capacity;
-        this->hash_index = other.hash_index;
-        this->status_ = other.status_;
+TEST_CASE("worst-case insert latency", "[.][benchmark]") {
+auto worst_insert = [](auto &table) {
+    auto worst = std::chrono::steady_clock::duration::zero();
+    for (int i = 0; i < 2000000; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        table.insert(i, i);
+        worst = std::max(worst, std::chrono::steady_clock::now() - start);
     }
+    return std::chrono::duration_cast<std::chrono::microseconds>(worst).count();
+};
+hash_map<int, int> stop_the_world;
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, incremental_rehash_policy> incremental;
+std::cout << "worst insert, stop-the-world rehash: " << worst_insert(stop_the_world) << " us" << std::endl;
+std::cout << "worst insert, incremental rehash:    " << worst_insert(incremental) << " us" << std::endl;
+}
 
-    reference operator*() const {
-        return *(p + hash_index);
-    }
+struct incremental_robin_hood_policy : robin_hood_policy {
+    static constexpr std::size_t rehash_step = 4;
+};
 
-    pointer operator->() const {
-        return p + hash_index;
+TEST_CASE("robin hood probing") {
+using robin_hood_map = hash_map<int, std::string, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, std::string>>, robin_hood_policy>;
+SECTION("insert/erase churn matches a reference map") {
+robin_hood_map table;
+std::unordered_map<int, std::string> reference;
+std::mt19937 rng(7);
+for (int step = 0; step < 50000; ++step) {
+    int key = static_cast<int>(rng() % 2000);
+    if (rng() % 2 == 0) {
+        bool inserted = table.insert(key, std::to_string(key)).second;
+        REQUIRE(inserted == reference.emplace(key, std::to_string(key)).second);
+    } else if (reference.erase(key) != 0) {
+        table.erase(key);
     }
+}
+REQUIRE(table.size() == reference.size());
+for (int key = 0; key < 2000; ++key) {
+    auto it = table.find(key);
+    REQUIRE((it != table.end()) == (reference.count(key) == 1));
+    if (it != table.end())
+        REQUIRE(it->second == std::to_string(key));
+}
+}
+SECTION("erase leaves no tombstones") {
+robin_hood_map table(64);
+for (int i = 0; i < 30; ++i)
+    table.insert(i * 64, "x");
+for (int i = 0; i < 30; i += 2)
+    table.erase(i * 64);
+int full = 0;
+for (auto it = table.begin(); it != table.end(); ++it)
+    ++full;
+REQUIRE(full == 15);
+for (int i = 1; i < 30; i += 2)
+    REQUIRE(table.find(i * 64) != table.end());
+}
+SECTION("probe distances past the control byte range") {
+robin_hood_map table(1024);
+for (int i = 0; i < 300; ++i)
+    table.insert(i * 1024, std::to_string(i));
+for (int i = 0; i < 300; i += 3)
+    table.erase(i * 1024);
+for (int i = 0; i < 300; ++i)
+    REQUIRE((table.find(i * 1024) != table.end()) == (i % 3 != 0));
+REQUIRE(table.find(5 * 1024)->second == "5");
+}
+SECTION("together with incremental rehash") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, incremental_robin_hood_policy> table;
+for (int i = 0; i < 5000; ++i) {
+    table.insert(i, i);
+    if (i % 5 == 0)
+        table.erase(i / 2);
+}
+std::set<int> erased;
+for (int i = 0; i < 5000; i += 5)
+    erased.insert(i / 2);
+for (int i = 0; i < 5000; ++i)
+    REQUIRE((table.find(i) != table.end()) == (erased.count(i) == 0));
+}
+}
 
-    // prefix ++
-    hash_map_iterator &operator++() {
-        for (int i = 0; i < capacity; ++i) {
-            if (status_[i] == FULL) {
-                hash_index = i;
-                return *this;
-            }
+TEST_CASE("lookup latency under insert/erase churn", "[.][benchmark]") {
+auto churn = [](auto &table, const char *name) {
+    int next = 0;
+    for (int i = 0; i < 50000; ++i)
+        table.insert(next++, 0);
+    for (int round = 0; round < 5; ++round) {
+        for (int i = 0; i < 200000; ++i) {
+            table.erase(next - 50000);
+            table.insert(next++, 0);
         }
-        hash_index = capacity;
-        return *this;
-    }
-
-    // postfix ++
-    hash_map_iterator operator++(int) {
-        auto tmp = hash_map_iterator(*this);
-        operator++();
-        return tmp;
+        auto start = std::chrono::steady_clock::now();
+        long hits = 0;
+        for (int key = next - 20000; key < next + 20000; ++key)
+            hits += table.find(key) != table.end();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << name << " round " << round << ": " << ns.count() / 40000.0 << " ns/find (" << hits
+                  << " hits)" << std::endl;
     }
+};
+hash_map<int, int> swiss;
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, robin_hood_policy> robin_hood;
+churn(swiss, "linear probing");
+churn(robin_hood, "robin hood    ");
+}
 
-    hash_map_iterator next_free_space() {
-        int i = 0;
-        while (status_[hash_index] == FULL) {
-            ++hash_index;
-            hash_index %= capacity;
-            ++i;
-            if (i == capacity - 1) {
-                hash_index = capacity;
-                return *this;
-            }
+TEST_CASE("concurrent hash map") {
+SECTION("single-threaded semantics") {
+concurrent_hash_map<std::string, int> table(2);
+REQUIRE(table.shard_count() == 4);
+REQUIRE(table.insert("a", 1));
+REQUIRE_FALSE(table.insert("a", 2));
+int value = 0;
+REQUIRE(table.find("a", value));
+REQUIRE(value == 1);
+REQUIRE(table.upsert("a", [](int &v) { v += 10; }) == false);
+REQUIRE(table.upsert("b", [](int &v) { v += 5; }) == true);
+REQUIRE(table.find("a", value));
+REQUIRE(value == 11);
+REQUIRE(table.erase("a"));
+REQUIRE_FALSE(table.erase("a"));
+REQUIRE_FALSE(table.contains("a"));
+REQUIRE(table.size() == 1);
+}
+SECTION("writers on several threads") {
+concurrent_hash_map<int, int> table;
+std::vector<std::thread> threads;
+for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&table, t] {
+        for (int i = 0; i < 5000; ++i) {
+            table.insert(t * 5000 + i, i);
+            table.upsert(-1 - i % 100, [](int &v) { ++v; });
         }
-        hash_index = i;
-        return *this;
-    }
+    });
+}
+for (auto &thread : threads)
+    thread.join();
+REQUIRE(table.size() == 40100);
+int value = 0;
+REQUIRE(table.find(39999, value));
+REQUIRE(value == 4999);
+REQUIRE(table.find(-1, value));
+REQUIRE(value == 8 * 50);
+std::atomic<size_t> visited{0};
+table.for_each_shard([&visited](size_t, const concurrent_hash_map<int, int>::shard_type &shard) {
+    for (auto it = shard.begin(); it != shard.end(); ++it)
+        ++visited;
+}, 4);
+REQUIRE(visited == 40100);
+}
+}
 
-    friend bool operator==(const hash_map_iterator<ValueType> &lhs, const hash_map_iterator<ValueType> &rhs) {
-        return (lhs.p + lhs.hash_index == rhs.p + rhs.hash_index);
+TEST_CASE("concurrent hash map throughput", "[.][benchmark]") {
+const int keys = 1 << 20;
+concurrent_hash_map<int, int> table(8);
+for (int i = 0; i < keys; ++i)
+    table.insert(i, i);
+for (unsigned threads = 1; threads <= 64; threads *= 2) {
+    const int ops = 4000000 / threads;
+    std::vector<std::thread> pool;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&table, t, ops] {
+            std::mt19937 rng(t);
+            int value = 0;
+            for (int i = 0; i < ops; ++i) {
+                int key = static_cast<int>(rng() % keys);
+                if (i % 10 == 0)
+                    table.upsert(key, [](int &v) { ++v; });
+                else
+                    table.find(key, value);
+            }
+        });
     }
+    for (auto &thread : pool)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << threads << " threads: " << static_cast<long>(ops * threads / seconds) << " ops/s" << std::endl;
+}
+}
 
-    friend bool operator!=(const hash_map_iterator<ValueType> &lhs, const hash_map_iterator<ValueType> &rhs) {
-        return !(lhs == rhs);
-    }
+/// Trivially copyable value whose halves must always be seen together.
+struct mirrored_pair {
+    int first, second;
 };
 
-template<typename ValueType>
-class hash_map_const_iterator {
-private:
-    ValueType *p;
-    int capacity = 0;
-    vector<status> status;
-    int hash_index = 0;
-public:
-    using iterator_category = std::forward_iterator_tag;
-    using value_type = ValueType;
-    using difference_type = std::ptrdiff_t;
-    using reference = const ValueType &;
-    using pointer = const ValueType *;
-
-    template<typename K, typename T,
-            typename Hash,
-            typename Pred,
-            typename Alloc>
-    friend
-    class hash_map;
-
-    hash_map_const_iterator() noexcept = default;
-
-    hash_map_const_iterator(const hash_map_const_iterator &other) noexcept {
-        this->p = other.p;
-        this->capacity = other.capacity;
-        this->hash_index = other.hash_index;
-        this->status = other.status;
-    }
+/// C-string keys drawn from one pool; the predicate counts keys that are not.
+struct pooled_key {
+    static inline std::vector<std::string> pool;
+    static inline std::atomic<long> strays{0};
 
-    hash_map_const_iterator(const hash_map_iterator<ValueType> &other) noexcept {
-        this->p = other.p;
-        this->capacity = other.capacity;
-        this->hash_index = other.hash_index;
-        this->status = other.status;
-    };
+    static bool pooled(const char *key) {
+        for (const auto &s : pool)
+            if (s.c_str() == key)
+                return true;
+        return false;
+    }
 
-    const reference operator*() const {
-        return *(p + hash_index);
+    size_t operator()(const char *key) const {
+        return std::hash<std::string_view>()(key);
     }
 
-    const pointer operator->() const {
-        return (p + hash_index);
+    bool operator()(const char *a, const char *b) const {
+        if (!pooled(a) || !pooled(b)) {
+            ++strays;
+            return false;
+        }
+        return std::strcmp(a, b) == 0;
     }
+};
 
-    // prefix ++
-    hash_map_const_iterator &operator++() {
-        for (int i = 0; i < capacity; ++i) {
-            if (status[i] == FULL) {
-                hash_index = i;
-                return *this;
+TEST_CASE("read-mostly hash map") {
+SECTION("single-threaded semantics") {
+read_mostly_hash_map<int, long> table;
+for (int i = 0; i < 1000; ++i)
+    REQUIRE(table.insert(i, i * 3L));
+REQUIRE_FALSE(table.insert(5, 0));
+REQUIRE_FALSE(table.insert_or_assign(5, -5));
+long value = 0;
+REQUIRE(table.find(5, value));
+REQUIRE(value == -5);
+for (int i = 0; i < 1000; i += 2)
+    REQUIRE(table.erase(i));
+REQUIRE_FALSE(table.erase(0));
+REQUIRE(table.size() == 500);
+for (int i = 0; i < 1000; ++i)
+    REQUIRE(table.contains(i) == (i % 2 == 1));
+}
+SECTION("tombstones do not fill the table") {
+read_mostly_hash_map<int, int> table;
+for (int round = 0; round < 100; ++round) {
+    for (int i = 0; i < 100; ++i)
+        table.insert(round * 100 + i, i);
+    for (int i = 0; i < 100; ++i)
+        table.erase(round * 100 + i);
+}
+REQUIRE(table.size() == 0);
+REQUIRE_FALSE(table.contains(42));
+}
+SECTION("readers see whole values while a writer updates and grows") {
+read_mostly_hash_map<int, mirrored_pair> table;
+for (int i = 0; i < 256; ++i)
+    table.insert(i, mirrored_pair{i, -i});
+std::atomic<bool> done{false};
+std::atomic<long> torn{0}, missing{0};
+std::vector<std::thread> readers;
+for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&] {
+        mirrored_pair value{};
+        while (!done.load()) {
+            for (int i = 0; i < 256; ++i) {
+                if (!table.find(i, value))
+                    ++missing;
+                else if (value.first != -value.second)
+                    ++torn;
             }
         }
-        hash_index = capacity;
-        return *this;
-    }
+    });
+}
+for (int round = 1; round < 200; ++round) {
+    for (int i = 0; i < 256; ++i)
+        table.insert_or_assign(i, mirrored_pair{i * round, -i * round});
+    for (int i = 0; i < 50; ++i)
+        table.insert(round * 1000 + i, mirrored_pair{0, 0});
+}
+done = true;
+for (auto &reader : readers)
+    reader.join();
+REQUIRE(torn == 0);
+REQUIRE(missing == 0);
+}
+SECTION("the predicate only sees keys that were stored whole") {
+pooled_key::pool.clear();
+for (int i = 0; i < 64; ++i)
+    pooled_key::pool.push_back("key-" + std::to_string(i));
+pooled_key::strays = 0;
+read_mostly_hash_map<const char *, int, pooled_key, pooled_key> table;
+std::atomic<bool> done{false};
+std::vector<std::thread> readers;
+for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&] {
+        int value = 0;
+        while (!done.load())
+            for (const auto &s : pooled_key::pool)
+                table.find(s.c_str(), value);
+    });
+}
+for (int round = 0; round < 2000; ++round) {
+    for (int i = 0; i < 64; ++i)
+        table.insert(pooled_key::pool[i].c_str(), round);
+    for (int i = 0; i < 64; ++i)
+        table.erase(pooled_key::pool[i].c_str());
+}
+done = true;
+for (auto &reader : readers)
+    reader.join();
+REQUIRE(pooled_key::strays == 0);
+}
+}
 
-    // postfix ++
-    hash_map_const_iterator operator++(int) {
-        auto tmp = hash_map_const_iterator(*this);
-        operator++();
-        return tmp;
+TEST_CASE("read-mostly hash map read scaling", "[.][benchmark]") {
+const int keys = 1 << 16;
+read_mostly_hash_map<int, int> lock_free;
+concurrent_hash_map<int, int> sharded;
+for (int i = 0; i < keys; ++i) {
+    lock_free.insert(i, i);
+    sharded.insert(i, i);
+}
+auto run = [keys](auto &table, unsigned threads) {
+    const int ops = 8000000 / threads;
+    std::vector<std::thread> pool;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&table, t, ops, keys] {
+            int value = 0, key = static_cast<int>(t);
+            for (int i = 0; i < ops; ++i) {
+                table.find(key, value);
+                key = (key + 7919) & (keys - 1);
+            }
+        });
     }
+    for (auto &thread : pool)
+        thread.join();
+    return static_cast<long>(ops * threads / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+};
+for (unsigned threads = 1; threads <= 64; threads *= 2)
+    std::cout << threads << " threads: seqlock " << run(lock_free, threads) << " reads/s, sharded "
+              << run(sharded, threads) << " reads/s" << std::endl;
+}
 
-    friend bool operator==(const hash_map_iterator<ValueType> &lhs, const hash_map_iterator<ValueType> &rhs) {
-        return lhs.p + lhs.hash_index == rhs.p + rhs.hash_index;
-    }
+TEST_CASE("batched lookups") {
+hash_map<int, int> table;
+for (int i = 0; i < 1000; i += 2)
+    table.insert(i, -i);
+std::vector<int> keys;
+for (int i = 0; i < 1000; ++i)
+    keys.push_back(i);
+std::vector<hash_map_iterator<std::pair<const int, int>>> found(keys.size());
+table.find_many(keys.data(), keys.size(), found.data());
+std::vector<uint64_t> bits((keys.size() + 63) / 64, ~uint64_t(0));
+table.contains_many(keys.data(), keys.size(), bits.data());
+for (int i = 0; i < 1000; ++i) {
+    bool present = i % 2 == 0;
+    REQUIRE((found[i] != table.end()) == present);
+    if (present)
+        REQUIRE(found[i]->second == -i);
+    REQUIRE(((bits[i / 64] >> (i % 64)) & 1u) == (present ? 1u : 0u));
+}
+const hash_map<int, int> &ref = table;
+std::vector<hash_map_const_iterator<std::pair<const int, int>>> const_found(3);
+ref.find_many(keys.data() + 10, 3, const_found.data());
+REQUIRE(const_found[0]->second == -10);
+REQUIRE(const_found[1] == ref.end());
+}
 
-    friend bool operator!=(const hash_map_iterator<ValueType> &lhs, const hash_map_iterator<ValueType> &rhs) {
-        return !(lhs == rhs);
-    }
+TEST_CASE("batched lookups on a table larger than the LLC", "[.][benchmark]") {
+const int size = 1 << 23;
+hash_map<int, int> table;
+for (int i = 0; i < size; ++i)
+    table.insert(i * 7, i);
+std::vector<int> keys(1 << 20);
+std::mt19937 rng(1);
+for (int &key : keys)
+    key = static_cast<int>(rng() % size) * 7;
+std::vector<uint64_t> bits(keys.size() / 64);
+BENCHMARK("find one at a time") {
+    long hits = 0;
+    for (int key : keys)
+        hits += table.find(key) != table.end();
+    return hits;
+};
+BENCHMARK("contains_many") {
+    table.contains_many(keys.data(), keys.size(), bits.data());
+    return bits[0];
 };
+}
 
+/// Counts every global allocation so tests can check that a code path does none.
+static std::atomic<long> allocation_count{0};
 
-template<typename K, typename T, typename Hash, typename Pred, typename Alloc>
-class hash_map {
-private:
-    using key_type = K;
-    using mapped_type = T;
-    using hasher = Hash;
-    using key_equal = Pred;
-    using allocator_type = Alloc;
-    using value_type = std::pair<const key_type, mapped_type>;
-    using reference = value_type &;
-    using const_reference = const value_type &;
-    using iterator = hash_map_iterator<value_type>;
-    using const_iterator = hash_map_const_iterator<value_type>;
-    using size_type = std::size_t;
-
-    float loadfactor = 0, max_loadfactor = 0.5;
-    size_type current_size = 0, capacity = 0;
-    value_type *arr;
-    vector<status> status_ptr;
-    allocator_type allocator_;
-    hasher hasher_;
-    key_equal equal_;
-public:
-    /// Default constructor.
-    hash_map() = default;
-
-    /**
-     *  @brief  Default constructor creates no elements.
-     *  @param n  Minimal initial number of buckets.
-     */
-    explicit hash_map(size_type n) : status_ptr(n, EMPTY) {
-        capacity = n;
-        if (n != 0) {
-            arr = allocator_.allocate(n);
-        }
-    }
+void *operator new(std::size_t n) {
+    ++allocation_count;
+    if (void *p = std::malloc(n == 0 ? 1 : n))
+        return p;
+    throw std::bad_alloc();
+}
 
-    ~hash_map() {
-        for (int i = 0; i < capacity; ++i) {
-            if (status_ptr[i] == FULL)
-                arr[i].~value_type();
-        }
-        allocator_.deallocate(arr, capacity);
-    }
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept {
+    ++allocation_count;
+    return std::malloc(n == 0 ? 1 : n);
+}
 
-    template<typename InputIterator>
-    hash_map(InputIterator first, InputIterator last, size_type n = 0) : hash_map(n) {
-        for (auto it = first; it != last; ++it) {
-            insert(it->first, it->second);
-        }
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
 
-    }
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
 
+TEST_CASE("heterogeneous lookup") {
+using string_map = hash_map<std::string, int, string_hash, std::equal_to<>>;
+string_map table;
+const std::string long_prefix(64, 'k');
+for (int i = 0; i < 100; ++i)
+    table.insert(long_prefix + std::to_string(i), i);
+SECTION("lookups by string_view and const char * do not allocate") {
+std::vector<std::string> storage;
+for (int i = 0; i < 200; ++i)
+    storage.push_back(long_prefix + std::to_string(i));
+std::vector<std::string_view> views(storage.begin(), storage.end());
+long before = allocation_count.load();
+int found = 0;
+for (std::string_view key : views) {
+    found += table.contains(key);
+    found += static_cast<int>(table.count(key));
+    if (table.find(key) != table.end())
+        found += table.at(key) >= 0;
+}
+REQUIRE(allocation_count.load() == before);
+REQUIRE(found == 300);
+REQUIRE_FALSE(table.contains("short"));
+}
+SECTION("equal_range and erase") {
+const std::string owned = long_prefix + "7";
+auto range = table.equal_range(std::string_view(owned));
+REQUIRE(std::distance(range.first, range.second) == 1);
+REQUIRE(range.first->second == 7);
+table.erase(std::string_view(owned));
+REQUIRE_FALSE(table.contains(std::string_view(owned)));
+auto missing = table.equal_range(std::string_view(owned));
+REQUIRE(missing.first == missing.second);
+REQUIRE_THROWS_AS(table.at(std::string_view(owned)), std::out_of_range);
+}
+SECTION("non-transparent maps still take key_type") {
+hash_map<std::string, int> plain;
+plain.insert("a", 1);
+REQUIRE(plain.contains("a"));
+REQUIRE(plain.count("b") == 0);
+}
+}
 
-    /// Copy constructor.
-    hash_map(const hash_map &other) : hash_map(other.capacity) {
-        for (auto it = other.begin(); it != other.end(); ++it) {
-            insert(*it);
-        }
-    }
+TEST_CASE("heterogeneous lookup throughput", "[.][benchmark]") {
+hash_map<std::string, int, string_hash, std::equal_to<>> table;
+std::vector<std::string> keys;
+for (int i = 0; i < 10000; ++i) {
+    keys.push_back("request/path/segment/" + std::to_string(i * 7919));
+    table.insert(keys.back(), i);
+}
+std::vector<std::string_view> views(keys.begin(), keys.end());
+BENCHMARK("find(std::string(view))") {
+    long sum = 0;
+    for (std::string_view view : views)
+        sum += table.find(std::string(view))->second;
+    return sum;
+};
+BENCHMARK("find(view)") {
+    long sum = 0;
+    for (std::string_view view : views)
+        sum += table.find(view)->second;
+    return sum;
+};
+}
 
-    /// Move constructor.
-    hash_map(hash_map &&other) noexcept {
-        swap(other);
-    }
+/// Counts its copies and moves so tests can check how often a value was duplicated.
+struct copy_counter {
+    static int copies, moves;
+    int value = 0;
+
+    copy_counter() = default;
+
+    explicit copy_counter(int value) : value(value) {}
 
-    explicit hash_map(const allocator_type &a) {
-        allocator_ = a;
+    copy_counter(const copy_counter &other) : value(other.value) {
+        ++copies;
     }
 
-    hash_map(std::initializer_list<value_type> l, size_type n = 0) : hash_map(n) {
-        for (auto it = l.begin(); it != l.end(); ++it) {
-            insert(it->first, it->second);
-        }
+    copy_counter(copy_counter &&other) noexcept: value(other.value) {
+        ++moves;
     }
 
-    /// Copy assignment operator.
-    hash_map &operator=(const hash_map &other) {
-        hash_map(other).swap(*this);
+    copy_counter &operator=(const copy_counter &other) {
+        value = other.value;
+        ++copies;
         return *this;
     }
 
-    /// Move assignment operator.
-    hash_map &operator=(hash_map &&other) noexcept {
-        swap(other);
+    copy_counter &operator=(copy_counter &&other) noexcept {
+        value = other.value;
+        ++moves;
         return *this;
     }
+};
 
-    hash_map &operator=(std::initializer_list<value_type> l) {
-        for (auto it = l.begin(); it != l.end(); ++it) {
-            insert(*it);
-        }
+int copy_counter::copies = 0;
+int copy_counter::moves = 0;
+
+TEST_CASE("emplace and friends") {
+copy_counter::copies = copy_counter::moves = 0;
+SECTION("try_emplace constructs in place and only when absent") {
+hash_map<int, copy_counter> table;
+REQUIRE(table.try_emplace(1, 10).second);
+REQUIRE_FALSE(table.try_emplace(1, 20).second);
+REQUIRE(table.find(1)->second.value == 10);
+REQUIRE(copy_counter::copies == 0);
+REQUIRE(copy_counter::moves == 0);
+}
+SECTION("emplace and insert of rvalues do not copy") {
+hash_map<int, copy_counter> table;
+REQUIRE(table.emplace(1, copy_counter(1)).second);
+REQUIRE(table.insert(std::pair<const int, copy_counter>(2, copy_counter(2))).second);
+REQUIRE(table.emplace(std::piecewise_construct, std::forward_as_tuple(3), std::forward_as_tuple(3)).second);
+REQUIRE_FALSE(table.emplace(1, copy_counter(5)).second);
+REQUIRE(copy_counter::copies == 0);
+REQUIRE(table.find(1)->second.value == 1);
+REQUIRE(table.find(3)->second.value == 3);
+}
+SECTION("insert_or_assign") {
+hash_map<std::string, std::string> table;
+REQUIRE(table.insert_or_assign("k", std::string("v1")).second);
+REQUIRE_FALSE(table.insert_or_assign("k", std::string("v2")).second);
+REQUIRE(table.at("k") == "v2");
+}
+SECTION("operator[] on an existing key builds nothing") {
+hash_map<int, copy_counter> table;
+table[7].value = 70;
+int moves = copy_counter::moves;
+REQUIRE(table[7].value == 70);
+REQUIRE(copy_counter::moves == moves);
+REQUIRE(copy_counter::copies == 0);
+}
+SECTION("rehash moves elements instead of copying them") {
+hash_map<std::string, std::vector<int>> table;
+const std::string long_prefix(40, 'x');
+for (int i = 0; i < 100; ++i)
+    table.try_emplace(long_prefix + std::to_string(i), 100, i);
+long before = allocation_count.load();
+table.rehash(table.bucket_count() * 8);
+REQUIRE(allocation_count.load() - before <= 2);
+for (int i = 0; i < 100; ++i)
+    REQUIRE(table.at(long_prefix + std::to_string(i))[99] == i);
+}
+SECTION("a throwing constructor leaves the table unchanged") {
+struct throws_on_negative {
+    explicit throws_on_negative(int v) {
+        if (v < 0)
+            throw std::invalid_argument("negative");
     }
+};
+hash_map<int, throws_on_negative> table;
+table.try_emplace(1, 1);
+REQUIRE_THROWS_AS(table.try_emplace(2, -1), std::invalid_argument);
+REQUIRE(table.size() == 1);
+REQUIRE(table.find(2) == table.end());
+REQUIRE(table.try_emplace(2, 2).second);
+}
+}
 
-    allocator_type get_allocator() const noexcept {
-        return allocator_;
-    }
+struct pow2_policy : hash_map_policy {
+    using bucket_index = pow2_index;
+};
 
-    bool empty() const noexcept {
-        return current_size == 0;
-    }
+struct modulo_policy : hash_map_policy {
+    using bucket_index = modulo_index;
+};
 
-    size_type size() const noexcept {
-        return current_size;
-    }
+/// Returns the key itself but claims to avalanche, so nothing fixes up its hashes.
+struct identity_hash {
+    using is_avalanching = void;
 
-    size_type max_size() const noexcept {
-        return std::numeric_limits<size_type>::max();
+    size_t operator()(size_t key) const {
+        return key;
     }
+};
 
-    void swap(hash_map &x) {
-        std::swap(arr, x.arr);
-        std::swap(allocator_, x.allocator_);
-        std::swap(capacity, x.capacity);
-        std::swap(loadfactor, x.loadfactor);
-        std::swap(max_loadfactor, x.max_loadfactor);
-        std::swap(hasher_, x.hasher_);
-        std::swap(status_ptr, x.status_ptr);
-        std::swap(current_size, x.current_size);
-        std::swap(equal_, x.equal_);
-    }
+TEST_CASE("bucket index policies") {
+SECTION("pow2_index rounds capacities up") {
+REQUIRE(pow2_index::capacity_for(0) == 0);
+REQUIRE(pow2_index::capacity_for(1) == 1);
+REQUIRE(pow2_index::capacity_for(7) == 8);
+REQUIRE(pow2_index::capacity_for(64) == 64);
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, pow2_policy> table(100);
+REQUIRE(table.bucket_count() == 128);
+}
+SECTION("indices stay in range") {
+std::mt19937_64 rng(11);
+for (int i = 0; i < 10000; ++i) {
+    size_t hash = rng();
+    REQUIRE(fastrange_index::index(hash, 7) < 7);
+    REQUIRE(pow2_index::index(hash, 64) < 64);
+    REQUIRE(modulo_index::index(hash, 13) < 13);
+}
+REQUIRE(fastrange_index::index(~size_t(0), 1000) == 999);
+}
+SECTION("every policy finds what it stored") {
+auto fill = [](auto &table) {
+    for (int i = 0; i < 20000; ++i)
+        table.insert(i * 1024, i);
+    for (int i = 0; i < 20000; i += 2)
+        table.erase(i * 1024);
+    for (int i = 0; i < 20000; ++i)
+        REQUIRE((table.find(i * 1024) != table.end()) == (i % 2 == 1));
+    REQUIRE(table.size() == 10000);
+};
+hash_map<int, int> fastrange;
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, pow2_policy> pow2;
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, modulo_policy> modulo;
+fill(fastrange);
+fill(pow2);
+fill(modulo);
+}
+SECTION("identity std::hash is mixed before indexing") {
+REQUIRE_FALSE(is_avalanching<std::hash<int>>::value);
+REQUIRE(is_avalanching<std::hash<std::string>>::value);
+REQUIRE(is_avalanching<string_hash>::value);
+std::set<size_t> homes;
+for (size_t key = 0; key < 64; ++key)
+    homes.insert(fastrange_index::index(mix_hash(key << 20), 64));
+REQUIRE(homes.size() > 32);
+}
+}
 
-    iterator begin() noexcept {
-        iterator it;
-        it.capacity = capacity;
-        it.status_ = status_ptr;
-        it.p = arr;
-        if (status_ptr[0] != FULL) {
-            it.operator++();
-            return it;
-        } else {
-            it.hash_index = 0;
-            return it;
-        }
-    }
+TEST_CASE("bucket index cost", "[.][benchmark]") {
+std::vector<size_t> keys(1 << 18);
+std::mt19937_64 rng(3);
+for (auto &key : keys)
+    key = rng();
+auto run = [&keys](auto &table, const char *name) {
+    for (size_t i = 0; i < keys.size(); ++i)
+        table.insert(keys[i], i);
+    BENCHMARK(std::string(name)) {
+        size_t sum = 0;
+        for (size_t key : keys)
+            sum += table.find(key)->second;
+        return sum;
+    };
+};
+hash_map<size_t, size_t, identity_hash, std::equal_to<size_t>,
+        My_allocator<std::pair<const size_t, size_t>>, modulo_policy> modulo;
+hash_map<size_t, size_t, identity_hash, std::equal_to<size_t>,
+        My_allocator<std::pair<const size_t, size_t>>, pow2_policy> pow2;
+hash_map<size_t, size_t, identity_hash> fastrange;
+run(modulo, "hash % capacity");
+run(pow2, "hash & (capacity - 1)");
+run(fastrange, "fastrange");
+}
 
-    const_iterator begin() const noexcept {
-        return cbegin();
+TEST_CASE("memory resource allocator") {
+using arena_map = hash_map<std::pmr::string, std::pmr::string, std::hash<std::pmr::string>>;
+using arena_allocator = My_allocator<std::pair<const std::pmr::string, std::pmr::string>>;
+static char buffer[1 << 20];
+std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+const std::string long_prefix(40, 'v');
+SECTION("the table and the strings in it come from the arena") {
+const std::string expected = long_prefix + "!";
+long before = allocation_count.load();
+{
+    arena_map table{arena_allocator(&arena)};
+    for (int i = 0; i < 300; ++i) {
+        std::pmr::string key(long_prefix, &arena);
+        key += std::to_string(i);
+        table.try_emplace(key, long_prefix);
+        table[key] += "!";
     }
+    REQUIRE(table.size() == 300);
+    std::pmr::string key(long_prefix, &arena);
+    key += "7";
+    REQUIRE(table.at(key) == std::string_view(expected));
+    REQUIRE(table.find(key)->first.get_allocator().resource() == &arena);
+    REQUIRE(table.find(key)->second.get_allocator().resource() == &arena);
+    arena_map copy(table);
+    REQUIRE(copy.get_allocator() == table.get_allocator());
+    REQUIRE(copy.size() == 300);
+}
+REQUIRE(allocation_count.load() == before);
+}
+SECTION("the default allocator still uses the global heap") {
+long before = allocation_count.load();
+hash_map<int, int> table;
+table.insert(1, 1);
+REQUIRE(table.get_allocator().resource() == nullptr);
+REQUIRE(allocation_count.load() > before);
+}
+}
 
-    const_iterator cbegin() const noexcept {
-        const_iterator it;
-        it.capacity = capacity;
-        it.status = status_ptr;
-        it.p = arr;
-        if (status_ptr[0] != FULL) {
-            it.operator++();
-            return it;
-        } else {
-            it.hash_index = 0;
-            return it;
-        }
-    }
-    float load_factor(){
-        return static_cast<float>(current_size/capacity);
-    }
+TEST_CASE("throwaway maps: heap versus arena", "[.][benchmark]") {
+const std::string long_prefix(40, 'v');
+std::vector<std::string> keys;
+for (int i = 0; i < 200; ++i)
+    keys.push_back(long_prefix + std::to_string(i));
+BENCHMARK("global heap") {
+    hash_map<std::string, std::string> table;
+    for (const std::string &key : keys)
+        table.try_emplace(key, key);
+    return table.size();
+};
+BENCHMARK("monotonic_buffer_resource") {
+    char buffer[64 * 1024];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+    hash_map<std::pmr::string, std::pmr::string, std::hash<std::pmr::string>> table{
+            My_allocator<std::pair<const std::pmr::string, std::pmr::string>>(&arena)};
+    for (const std::string &key : keys)
+        table.try_emplace(std::pmr::string(key, &arena), key);
+    return table.size();
+};
+}
 
+#if defined(__linux__)
+
+TEST_CASE("huge page resource") {
+SECTION("large blocks are huge-page aligned, small ones come from upstream") {
+huge_page_resource resource(huge_page_resource::pages::explicit_huge);
+void *big = resource.allocate(3 << 20, 64);
+REQUIRE(reinterpret_cast<std::uintptr_t>(big) % huge_page_resource::huge_page_size == 0);
+std::memset(big, 1, 3 << 20);
+resource.deallocate(big, 3 << 20, 64);
+void *small = resource.allocate(100, 8);
+REQUIRE(small != nullptr);
+resource.deallocate(small, 100, 8);
+}
+SECTION("tables work in every mode, with or without reserved huge pages") {
+for (auto mode : {huge_page_resource::pages::small, huge_page_resource::pages::transparent,
+                  huge_page_resource::pages::explicit_huge}) {
+    huge_page_resource resource(mode, huge_page_resource::numa::interleave, 1);
+    hash_map<int, int> table{My_allocator<std::pair<const int, int>>(&resource)};
+    for (int i = 0; i < 200000; ++i)
+        table.insert(i, i);
+    for (int i = 0; i < 200000; i += 7)
+        REQUIRE(table.at(i) == i);
+}
+}
+}
 
+/// Opens a dTLB read-miss counter for this thread; -1 when perf events are unavailable.
+static int open_dtlb_counter() {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
 
-    iterator end() noexcept {
-        iterator it;
-        it.capacity = capacity;
-        it.status_ = status_ptr;
-        it.p = arr;
-        it.hash_index = capacity;
-        return it;
+TEST_CASE("random lookups with 4K and 2M pages", "[.][benchmark]") {
+const int size = 1 << 23;
+std::vector<int> keys(1 << 22);
+std::mt19937 rng(13);
+for (int &key : keys)
+    key = static_cast<int>(rng() % size);
+auto run = [&](huge_page_resource::pages mode, const char *name) {
+    huge_page_resource resource(mode);
+    hash_map<int, int> table{My_allocator<std::pair<const int, int>>(&resource)};
+    table.reserve(size);
+    for (int i = 0; i < size; ++i)
+        table.insert(i, i);
+    int counter = open_dtlb_counter();
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
     }
-
-    const_iterator end() const noexcept {
-        return cend();
+    auto start = std::chrono::steady_clock::now();
+    long sum = 0;
+    for (int key : keys)
+        sum += table.find(key)->second;
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << keys.size() / seconds.count() / 1e6 << " M lookups/s";
+    uint64_t misses = 0;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) == sizeof(misses))
+            std::cout << ", " << static_cast<double>(misses) / keys.size() << " dTLB misses/lookup";
+        close(counter);
+    } else {
+        std::cout << ", dTLB counter unavailable";
     }
+    std::cout << ", huge page fallbacks " << resource.huge_page_fallbacks() << " (checksum " << sum << ")"
+              << std::endl;
+};
+run(huge_page_resource::pages::small, "4K pages       ");
+run(huge_page_resource::pages::transparent, "transparent 2M ");
+run(huge_page_resource::pages::explicit_huge, "MAP_HUGETLB 2M ");
+}
 
-    const_iterator cend() const noexcept {
-        const_iterator it;
-        it.capacity = capacity;
-        it.status = status_ptr;
-        it.p = arr;
-        it.hash_index = capacity;
-        return it;
-    }
-    size_type bucket_count() const noexcept {
-        return capacity;
-    }
+#endif
+
+#if defined(__linux__)
+
+TEST_CASE("memory-mapped hash map") {
+const std::string path = "/tmp/mapped_hash_map_test_" + std::to_string(getpid()) + ".bin";
+using mapped_map = mapped_hash_map<uint64_t, uint64_t>;
+SECTION("contents survive reopening, read-only or not") {
+{
+    mapped_map table = mapped_map::create(path, 16);
+    for (uint64_t i = 0; i < 50000; ++i)
+        REQUIRE(table.insert(i * 3, i));
+    REQUIRE_FALSE(table.insert(3, 7));
+    REQUIRE_FALSE(table.insert_or_assign(3, 7));
+    for (uint64_t i = 0; i < 50000; i += 5)
+        REQUIRE(table.erase(i * 3));
+    table.flush();
+}
+{
+    mapped_map table = mapped_map::open(path);
+    REQUIRE(table.size() == 40000);
+    REQUIRE(table.at(3) == 7);
+    for (uint64_t i = 0; i < 50000; ++i)
+        REQUIRE(table.contains(i * 3) == (i % 5 != 0));
+    REQUIRE_FALSE(table.contains(1));
+    REQUIRE_THROWS_WITH(table.at(1), "item not found");
+    REQUIRE_THROWS_AS(table.insert(1, 1), std::logic_error);
+    mapped_map second = mapped_map::open(path);
+    REQUIRE(*second.find(6) == 2);
+}
+{
+    mapped_map table = mapped_map::open(path, mapped_map::access::read_write);
+    REQUIRE(table.insert(1, 1));
+}
+REQUIRE(mapped_map::open(path).at(1) == 1);
+}
+SECTION("files from another layout are rejected") {
+mapped_map::create(path, 16).insert(1, 1);
+REQUIRE_THROWS_AS((mapped_hash_map<uint32_t, uint64_t>::open(path)), std::runtime_error);
+REQUIRE_THROWS_AS(mapped_map::open(path + ".missing"), std::runtime_error);
+}
+std::remove(path.c_str());
+}
 
-    std::pair<iterator, bool> insert(K key, T value) {
-        if (capacity == 0) {
-            rehash(3);
-        }
-        if (loadfactor >= max_loadfactor) {
-            rehash(capacity * 2);
-        }
+TEST_CASE("startup: rebuilding versus reopening", "[.][benchmark]") {
+const std::string path = "/tmp/mapped_hash_map_bench_" + std::to_string(getpid()) + ".bin";
+const uint64_t n = 2000000;
+{
+    mapped_hash_map<uint64_t, uint64_t> table = mapped_hash_map<uint64_t, uint64_t>::create(path, n);
+    for (uint64_t i = 0; i < n; ++i)
+        table.insert(i, i);
+    table.flush();
+}
+auto start = std::chrono::steady_clock::now();
+hash_map<uint64_t, uint64_t> rebuilt;
+for (uint64_t i = 0; i < n; ++i)
+    rebuilt.insert(i, i);
+auto rebuild = std::chrono::steady_clock::now() - start;
+start = std::chrono::steady_clock::now();
+auto reopened = mapped_hash_map<uint64_t, uint64_t>::open(path);
+auto reopen = std::chrono::steady_clock::now() - start;
+std::cout << "rebuild " << n << " entries with insert: "
+          << std::chrono::duration_cast<std::chrono::microseconds>(rebuild).count() << " us, reopen: "
+          << std::chrono::duration_cast<std::chrono::microseconds>(reopen).count() << " us ("
+          << reopened.size() << " entries)" << std::endl;
+std::remove(path.c_str());
+}
 
-        bool state;
-        int hash_index = hasher_(key) % capacity;
-        if (status_ptr[hash_index] == EMPTY) {
-            state = true;
-            current_size++;
-            loadfactor = static_cast<float>(current_size) / capacity;
-            status_ptr[hash_index] = FULL;
-            new(arr + hash_index) value_type(key, value);
-            return pair<iterator, bool>(hash_map_iterator<value_type>(arr, capacity, status_ptr, hash_index), state);
-        }
-        iterator find_ = find(key);
-        if (find_ != end()) {
-            state = false;
-            return pair<iterator, bool>(find_, state);
-        } else{
-            iterator it(arr, capacity, status_ptr, hash_index=find_.hash_index);
-            it = it.next_free_space();
-            state = true;
-            current_size++;
-            loadfactor = static_cast<float>(current_size) / capacity;
-            status_ptr[it.hash_index] = FULL;
-            new(arr + it.hash_index) value_type(key, value);
-            return pair<iterator, bool>(iterator(arr, capacity, status_ptr, hash_index), state);
-        }
+#endif
 
-    }
+/// std::hash<int> with a seed, standing in for a hasher that changed between save and load.
+struct seeded_hash {
+    size_t seed = 0x5eed;
 
-    void erase(K key) {
-        iterator it = find(key);
-        if (it == end()) {
-            cout << "There is no such element in the map" << endl;
-            return;
-        } else {
-            (arr + it.hash_index)->~value_type();
-            current_size--;
-            loadfactor = static_cast<float>(current_size) / capacity;
-            status_ptr[it.hash_index] = DELETED;
-        }
+    size_t operator()(int key) const {
+        return std::hash<int>()(key) ^ seed;
     }
+};
 
-    void clear() noexcept {
-        for (int i = 0; i < capacity; ++i) {
-            if (status_ptr[i] == FULL)
-                arr[i].~value_type();
-        }
-    }
+TEST_CASE("snapshots") {
+SECTION("raw round trip") {
+hash_map<int, int> table;
+for (int i = 0; i < 10000; ++i)
+    table.insert(i, -i);
+for (int i = 0; i < 10000; i += 3)
+    table.erase(i);
+std::stringstream stream;
+table.save(stream);
+hash_map<int, int> loaded;
+loaded.insert(-1, 1);
+loaded.load(stream);
+REQUIRE(loaded.size() == table.size());
+REQUIRE(loaded.bucket_count() == table.bucket_count());
+REQUIRE(loaded.find(-1) == loaded.end());
+for (int i = 0; i < 10000; ++i)
+    REQUIRE((loaded.find(i) != loaded.end()) == (i % 3 != 0));
+REQUIRE(loaded.at(5) == -5);
+loaded.insert(10001, 1);
+REQUIRE(loaded.at(10001) == 1);
+}
+SECTION("robin hood tables and empty tables") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, robin_hood_policy> table, loaded;
+std::stringstream empty;
+table.save(empty);
+loaded.load(empty);
+REQUIRE(loaded.empty());
+for (int i = 0; i < 5000; ++i)
+    table.insert(i * 64, i);
+std::stringstream stream;
+table.save(stream);
+loaded.load(stream);
+for (int i = 0; i < 5000; ++i)
+    REQUIRE(loaded.at(i * 64) == i);
+}
+SECTION("strings go through serializer") {
+hash_map<std::string, std::string> table;
+for (int i = 0; i < 1000; ++i)
+    table.insert("key " + std::to_string(i), std::string(i % 50, 'x'));
+std::stringstream stream;
+table.save(stream);
+hash_map<std::string, std::string> loaded;
+loaded.load(stream);
+REQUIRE(loaded.size() == 1000);
+for (int i = 0; i < 1000; ++i)
+    REQUIRE(loaded.at("key " + std::to_string(i)) == std::string(i % 50, 'x'));
+}
+SECTION("a different hasher forces a rehash") {
+hash_map<int, int> table;
+for (int i = 0; i < 1000; ++i)
+    table.insert(i, i);
+std::stringstream stream;
+table.save(stream);
+hash_map<int, int, seeded_hash> loaded;
+loaded.load(stream);
+REQUIRE(loaded.size() == 1000);
+for (int i = 0; i < 1000; ++i)
+    REQUIRE(loaded.at(i) == i);
+}
+SECTION("bad input is rejected") {
+hash_map<int, int> table;
+table.insert(1, 1);
+std::stringstream stream;
+table.save(stream);
+std::string bytes = stream.str();
+std::stringstream truncated(bytes.substr(0, bytes.size() - 4));
+hash_map<int, int> loaded;
+REQUIRE_THROWS_AS(loaded.load(truncated), std::runtime_error);
+std::stringstream garbage("not a snapshot at all, not even close to one....................");
+REQUIRE_THROWS_AS(loaded.load(garbage), std::runtime_error);
+std::stringstream other_types(bytes);
+hash_map<int64_t, int> wider;
+REQUIRE_THROWS_AS(wider.load(other_types), std::runtime_error);
+}
+}
 
-    Hash hash_function() const {
-        return hasher_;
-    }
+TEST_CASE("bulk load from a snapshot", "[.][benchmark]") {
+hash_map<int, int> table;
+for (int i = 0; i < 1000000; ++i)
+    table.insert(i, i);
+std::stringstream stream;
+table.save(stream);
+const std::string bytes = stream.str();
+BENCHMARK("insert one by one") {
+    hash_map<int, int> rebuilt;
+    for (int i = 0; i < 1000000; ++i)
+        rebuilt.insert(i, i);
+    return rebuilt.size();
+};
+BENCHMARK("load") {
+    std::stringstream in(bytes);
+    hash_map<int, int> loaded;
+    loaded.load(in);
+    return loaded.size();
+};
+}
 
-    Pred key_eq() const {
-        return equal_;
+TEST_CASE("bulk build") {
+std::vector<std::pair<int, int>> pairs;
+std::mt19937 rng(16);
+for (int i = 0; i < 300000; ++i)
+    pairs.emplace_back(static_cast<int>(rng() % 100000), i);
+std::unordered_map<int, int> first, last, sum;
+for (const auto &p : pairs) {
+    first.emplace(p.first, p.second);
+    last[p.first] = p.second;
+    sum[p.first] += p.second;
+}
+auto same = [](const hash_map<int, int> &table, const std::unordered_map<int, int> &expected) {
+    REQUIRE(table.size() == expected.size());
+    for (const auto &p : expected)
+        REQUIRE(table.at(p.first) == p.second);
+};
+SECTION("range constructor keeps the first occurrence") {
+hash_map<int, int> table(pairs.begin(), pairs.end());
+same(table, first);
+}
+SECTION("duplicate policies, on four threads") {
+hash_map<int, int> keep_last_table, sum_table;
+keep_last_table.bulk_insert(pairs.begin(), pairs.end(), keep_last(), 4);
+sum_table.bulk_insert(pairs.begin(), pairs.end(), [](int &existing, int incoming) { existing += incoming; }, 4);
+same(keep_last_table, last);
+same(sum_table, sum);
+}
+SECTION("stateful combine gets a copy per thread") {
+// Appends to its own scratch vector on every merge, which would race if the threads shared one.
+struct summing {
+    std::vector<int> merged;
+
+    void operator()(int &existing, int incoming) {
+        merged.push_back(incoming);
+        existing += incoming;
     }
+};
+hash_map<int, int> table;
+table.bulk_insert(pairs.begin(), pairs.end(), summing(), 4);
+same(table, sum);
+}
+SECTION("more threads than the table has room to split") {
+hash_map<int, int> table;
+std::vector<std::pair<int, int>> clustered;
+for (int i = 0; i < 70000; ++i)
+    clustered.emplace_back(i % 3, i);
+table.bulk_insert(clustered.begin(), clustered.end(), keep_first(), 64);
+REQUIRE(table.size() == 3);
+REQUIRE(table.at(2) == 2);
+}
+SECTION("sequential fallbacks") {
+hash_map<int, int> table;
+table.insert(-1, -1);
+table.bulk_insert(pairs.begin(), pairs.end(), keep_last(), 4);
+REQUIRE(table.size() == last.size() + 1);
+hash_map<int, int, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, int>>, robin_hood_policy> robin_hood(pairs.begin(), pairs.end());
+REQUIRE(robin_hood.size() == first.size());
+REQUIRE(robin_hood.at(pairs[0].first) == first[pairs[0].first]);
+}
+}
 
-    iterator find(K key) {
-        int hash_index = hasher_(key) % capacity;
-        if (status_ptr[hash_index] == FULL and arr[hash_index].first == key)
-            return iterator(arr, capacity, status_ptr, hash_index);
-        else {
-            int i = 0;
-            while (status_ptr[hash_index] != FULL or arr[hash_index].first != key) {
-                if (status_ptr[hash_index] == EMPTY)
-                    return end();
-                ++hash_index;
-                hash_index %= capacity;
-                if (i == capacity - 1) {
-                    return end();
-                }
-                ++i;
-            }
-            return iterator(arr, capacity, status_ptr, hash_index);
-        }
-    }
+TEST_CASE("bulk build throughput", "[.][benchmark]") {
+std::vector<std::pair<int, int>> pairs;
+std::mt19937 rng(17);
+for (int i = 0; i < 4000000; ++i)
+    pairs.emplace_back(static_cast<int>(rng()), i);
+BENCHMARK("one insert at a time") {
+    hash_map<int, int> table;
+    for (const auto &p : pairs)
+        table.insert(p);
+    return table.size();
+};
+BENCHMARK("bulk_insert, one thread") {
+    hash_map<int, int> table;
+    table.bulk_insert(pairs.begin(), pairs.end(), keep_first(), 1);
+    return table.size();
+};
+BENCHMARK("bulk_insert, all cores") {
+    hash_map<int, int> table;
+    table.bulk_insert(pairs.begin(), pairs.end());
+    return table.size();
+};
+// Scaling on a machine with enough cores; extra threads only add overhead on fewer.
+for (unsigned threads = 2; threads <= 16; threads *= 2) {
+    BENCHMARK("bulk_insert, " + std::to_string(threads) + " threads") {
+        hash_map<int, int> table;
+        table.bulk_insert(pairs.begin(), pairs.end(), keep_first(), threads);
+        return table.size();
+    };
+}
+}
 
-    void rehash(size_type n) {
-        if (n < capacity)
-            return;
-        hash_map temp(begin(), end(), n);
-        swap(temp);
-    }
+/// 16-byte key for layout benchmarks.
+struct key16 {
+    uint64_t high, low;
 
-    template<typename _H2, typename _P2>
-    void merge(hash_map<K, T, _H2, _P2, Alloc>& source) {
-        for (int i = 0; i<source.capacity; ++i){
-            if (source.status_ptr[i] == FULL)
-                insert(source.arr[i]);
-        }
+    bool operator==(const key16 &other) const {
+        return high == other.high && low == other.low;
     }
+};
 
-    template<typename _H2, typename _P2>
-    void merge(hash_map<K, T, _H2, _P2, Alloc>&& source) {
-        for (int i = 0; i<source.capacity; ++i){
-            if (source.status_ptr[i] == FULL)
-                insert(source.arr[i]);
-        }
+struct key16_hash {
+    size_t operator()(const key16 &key) const {
+        return std::hash<uint64_t>()(key.high * 0x9E3779B97F4A7C15ull ^ key.low);
     }
+};
 
+/// Every default-constructed instance hashes with a different seed, so a
+/// copy that default-constructs its hasher shows up as a changed seed.
+struct instance_seeded_hash {
+    static inline size_t next_seed = 1;
+    size_t seed = next_seed++ * 0x9E3779B97F4A7C15ull;
 
-    mapped_type& operator[](const key_type& k) {
-        auto res =insert(k, mapped_type ());
-        return res.first->second;
+    size_t operator()(uint64_t key) const {
+        return std::hash<uint64_t>()(key ^ seed);
     }
+};
 
-    mapped_type& operator[](key_type&& k) {
-        auto res =insert(move(k), mapped_type ());
-        return res.first->second;
-    }
+TEST_CASE("bucketized layout") {
+SECTION("buckets are cache lines") {
+REQUIRE(bucket_hash_map<uint64_t, uint64_t>::slots_per_bucket == 7);
+REQUIRE_FALSE(bucket_hash_map<uint64_t, uint64_t>::inline_values);
+REQUIRE(bucket_hash_map<uint32_t, uint32_t>::slots_per_bucket == 7);
+REQUIRE(bucket_hash_map<uint32_t, uint32_t>::inline_values);
+REQUIRE(bucket_hash_map<key16, uint64_t, key16_hash>::slots_per_bucket == 2);
+REQUIRE(bucket_hash_map<key16, uint64_t, key16_hash>::inline_values);
+REQUIRE(bucket_hash_map<char, uint64_t>::slots_per_bucket == 32);
+}
+SECTION("a full 32-slot bucket") {
+bucket_hash_map<char, uint64_t> table;
+for (int c = 0; c < 128; ++c)
+    REQUIRE(table.insert(static_cast<char>(c), c));
+for (int c = 0; c < 128; ++c)
+    REQUIRE(table.at(static_cast<char>(c)) == static_cast<uint64_t>(c));
+REQUIRE_FALSE(table.contains(static_cast<char>(-1)));
+}
+SECTION("insert, find and erase") {
+bucket_hash_map<uint64_t, uint64_t> table;
+for (uint64_t i = 0; i < 100000; ++i)
+    REQUIRE(table.insert(i * 4096, i));
+REQUIRE_FALSE(table.insert(4096, 0));
+REQUIRE_FALSE(table.insert_or_assign(4096, 7));
+for (uint64_t i = 0; i < 100000; i += 2)
+    REQUIRE(table.erase(i * 4096));
+REQUIRE_FALSE(table.erase(0));
+REQUIRE(table.size() == 50000);
+for (uint64_t i = 0; i < 100000; ++i)
+    REQUIRE(table.contains(i * 4096) == (i % 2 == 1));
+REQUIRE(table.at(4096) == 7);
+REQUIRE_THROWS_AS(table.at(1), std::out_of_range);
+bucket_hash_map<uint64_t, uint64_t> copy(table);
+uint64_t sum = 0;
+copy.for_each([&sum](uint64_t, uint64_t value) { sum += value; });
+REQUIRE(sum == 2500000000ull - 1 + 7);
+bucket_hash_map<uint64_t, uint64_t> moved(std::move(copy));
+REQUIRE(moved.size() == 50000);
+REQUIRE(copy.empty());
+REQUIRE(copy.insert(2, 2));
+REQUIRE(copy.at(2) == 2);
+bucket_hash_map<uint64_t, uint64_t, instance_seeded_hash> seeded;
+for (uint64_t i = 0; i < 1000; ++i)
+    seeded.insert(i, i);
+bucket_hash_map<uint64_t, uint64_t, instance_seeded_hash> seeded_copy(seeded);
+REQUIRE(seeded_copy.hash_function().seed == seeded.hash_function().seed);
+for (uint64_t i = 0; i < 1000; ++i)
+    REQUIRE(seeded_copy.at(i) == i);
+}
+SECTION("inline values and 16-byte keys") {
+bucket_hash_map<uint32_t, uint32_t> small;
+bucket_hash_map<key16, uint64_t, key16_hash> wide;
+for (uint32_t i = 0; i < 20000; ++i) {
+    small.insert(i, i + 1);
+    wide.insert(key16{i, ~uint64_t(i)}, i);
+}
+for (uint32_t i = 0; i < 20000; ++i) {
+    REQUIRE(small.at(i) == i + 1);
+    REQUIRE(wide.at(key16{i, ~uint64_t(i)}) == i);
+}
+REQUIRE_FALSE(wide.contains(key16{1, 1}));
+}
+}
 
-    mapped_type& at(const key_type& k){
-        iterator iter = find(k);
-        if(iter == end()) {
-            throw std::out_of_range("item not found");
-        }
-        return (iter->second);
-    }
+TEST_CASE("bucketized versus split layout", "[.][benchmark]") {
+const int size = 1 << 22;
+std::vector<uint64_t> keys(size);
+std::mt19937_64 rng(17);
+for (auto &key : keys)
+    key = rng();
+std::vector<uint64_t> probes(1 << 20);
+for (auto &probe : probes)
+    probe = keys[rng() % size];
+
+hash_map<uint64_t, uint64_t> split8;
+bucket_hash_map<uint64_t, uint64_t> bucketed8;
+hash_map<key16, uint64_t, key16_hash> split16;
+bucket_hash_map<key16, uint64_t, key16_hash> bucketed16;
+for (int i = 0; i < size; ++i) {
+    split8.insert(keys[i], i);
+    bucketed8.insert(keys[i], i);
+    split16.insert(key16{keys[i], keys[i]}, i);
+    bucketed16.insert(key16{keys[i], keys[i]}, i);
+}
+BENCHMARK("8-byte keys, hash_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += split8.find(key)->second;
+    return sum;
+};
+BENCHMARK("8-byte keys, bucket_hash_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += *bucketed8.find(key);
+    return sum;
+};
+BENCHMARK("16-byte keys, hash_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += split16.find(key16{key, key})->second;
+    return sum;
+};
+BENCHMARK("16-byte keys, bucket_hash_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += *bucketed16.find(key16{key, key});
+    return sum;
+};
+}
 
+TEST_CASE("flat map and set") {
+SECTION("key groups") {
+uint64_t keys[key_group<uint64_t>::width] = {};
+keys[key_group<uint64_t>::width - 1] = 42;
+key_group<uint64_t> group(keys);
+REQUIRE(key_group<uint64_t>::slot(group.match(42)) == key_group<uint64_t>::width - 1);
+REQUIRE(key_group<uint64_t>::slot(group.match(0)) == 0);
+REQUIRE(group.match(42 + (uint64_t(1) << 32)) == 0);
+}
+SECTION("insert, find and erase") {
+flat_map<uint32_t, uint32_t> table;
+for (uint32_t i = 0; i < 100000; ++i)
+    REQUIRE(table.insert(i * 7919, i));
+REQUIRE_FALSE(table.insert(7919, 0));
+REQUIRE_FALSE(table.insert_or_assign(7919, 5));
+REQUIRE(table.load_factor() <= table.max_load_factor());
+REQUIRE(table.load_factor() > 0.4f);
+for (uint32_t i = 0; i < 100000; i += 2)
+    REQUIRE(table.erase(i * 7919));
+REQUIRE_FALSE(table.erase(0));
+REQUIRE(table.size() == 50000);
+for (uint32_t i = 0; i < 100000; ++i)
+    REQUIRE(table.contains(i * 7919) == (i % 2 == 1));
+REQUIRE(table.at(7919) == 5);
+REQUIRE_THROWS_AS(table.at(2), std::out_of_range);
+flat_map<uint32_t, uint32_t> copy(table);
+uint64_t sum = 0;
+copy.for_each([&sum](uint32_t, uint32_t value) { sum += value; });
+REQUIRE(sum == 2500000000ull - 1 + 5);
+flat_map<uint32_t, uint32_t> moved(std::move(copy));
+REQUIRE(moved.size() == 50000);
+REQUIRE(copy.empty());
+REQUIRE(copy.insert(2, 2));
+REQUIRE(copy.at(2) == 2);
+}
+SECTION("sentinel keys are ordinary keys") {
+flat_map<int64_t, int> table;
+REQUIRE(table.insert(flat_map<int64_t, int>::empty_key, 1));
+REQUIRE(table.insert(flat_map<int64_t, int>::deleted_key, 2));
+REQUIRE(table.insert(-1, 3));
+REQUIRE(table.size() == 3);
+table.reserve(1000);
+REQUIRE(table.at(flat_map<int64_t, int>::empty_key) == 1);
+REQUIRE(table.at(flat_map<int64_t, int>::deleted_key) == 2);
+REQUIRE(table.erase(flat_map<int64_t, int>::empty_key));
+REQUIRE_FALSE(table.contains(flat_map<int64_t, int>::empty_key));
+REQUIRE(table.size() == 2);
+}
+SECTION("churn does not grow the table") {
+flat_map<uint64_t, uint64_t> table(1000);
+size_t buckets = table.bucket_count();
+for (uint64_t i = 0; i < 100000; ++i) {
+    table.insert(i, i);
+    if (i >= 400)
+        table.erase(i - 400);
+}
+REQUIRE(table.size() == 400);
+REQUIRE(table.bucket_count() == buckets);
+}
+SECTION("max load factor") {
+flat_map<uint32_t, uint32_t> table;
+REQUIRE(table.max_load_factor() == flat_map<uint32_t, uint32_t>::load_limit);
+REQUIRE_THROWS_AS(table.max_load_factor(0.95f), std::invalid_argument);
+table.max_load_factor(0.5f);
+for (uint32_t i = 0; i < 10000; ++i)
+    table.insert(i, i);
+REQUIRE(table.load_factor() <= 0.5f);
+}
+SECTION("set") {
+flat_set<uint16_t> set;
+for (uint32_t i = 0; i < 65536; i += 3)
+    set.insert(static_cast<uint16_t>(i));
+REQUIRE(set.contains(65535));
+REQUIRE(set.contains(65532));
+REQUIRE_FALSE(set.contains(1));
+REQUIRE(set.erase(65535));
+size_t count = 0;
+set.for_each([&count](uint16_t) { ++count; });
+REQUIRE(count == set.size());
+REQUIRE(set.size() == 21845);
+}
+}
 
-    const mapped_type& at(const key_type& k) const{
-        const_iterator iter = find(k);
-        if(iter == end()) {
-            throw std::out_of_range("item not found");
-        }
-        return (iter->second);
-    }
+TEST_CASE("flat map versus hash_map", "[.][benchmark]") {
+const int size = 1 << 22;
+std::vector<uint64_t> keys(size);
+std::mt19937_64 rng(18);
+for (auto &key : keys)
+    key = rng();
+std::vector<uint64_t> probes(1 << 20);
+for (auto &probe : probes)
+    probe = keys[rng() % size];
+
+hash_map<uint32_t, uint32_t> split32;
+flat_map<uint32_t, uint32_t> flat32;
+hash_map<uint64_t, uint64_t> split64;
+flat_map<uint64_t, uint64_t> flat64;
+split32.reserve(size);
+flat32.reserve(size);
+split64.reserve(size);
+flat64.reserve(size);
+for (int i = 0; i < size; ++i) {
+    split32.insert(static_cast<uint32_t>(keys[i]), i);
+    flat32.insert(static_cast<uint32_t>(keys[i]), i);
+    split64.insert(keys[i], i);
+    flat64.insert(keys[i], i);
+}
+std::cout << "bytes per entry, uint32_t: hash_map "
+          << split32.bucket_count() * (sizeof(std::pair<const uint32_t, uint32_t>) + 1) / double(split32.size())
+          << ", flat_map " << flat32.bucket_count() * 8 / double(flat32.size()) << "\n"
+          << "bytes per entry, uint64_t: hash_map "
+          << split64.bucket_count() * (sizeof(std::pair<const uint64_t, uint64_t>) + 1) / double(split64.size())
+          << ", flat_map " << flat64.bucket_count() * 16 / double(flat64.size()) << std::endl;
+BENCHMARK("uint32_t, hash_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += split32.find(static_cast<uint32_t>(key))->second;
+    return sum;
+};
+BENCHMARK("uint32_t, flat_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += *flat32.find(static_cast<uint32_t>(key));
+    return sum;
+};
+BENCHMARK("uint64_t, hash_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += split64.find(key)->second;
+    return sum;
+};
+BENCHMARK("uint64_t, flat_map") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += *flat64.find(key);
+    return sum;
+};
+}
 
-    void reserve(size_type n) {
-        rehash(ceil(n / max_loadfactor));
-    }
+struct stats_robin_hood_policy : robin_hood_policy {
+    static constexpr bool collect_stats = true;
+};
 
+struct stats_incremental_policy : incremental_rehash_policy {
+    static constexpr bool collect_stats = true;
 };
 
-///////////////////////////////////////////
+TEST_CASE("statistics") {
+SECTION("probe histograms and rehashes") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>, stats_policy> table;
+for (int i = 0; i < 1000; ++i)
+    table.insert(i, i);
+table.reset_stats();
+for (int i = 0; i < 2000; ++i)
+    table.contains(i);
+hash_map_stats s = table.stats();
+uint64_t hits = 0, misses = 0;
+for (size_t k = 0; k < hash_map_stats::histogram_size; ++k) {
+    hits += s.hit_probes[k];
+    misses += s.miss_probes[k];
+}
+REQUIRE(hits == 1000);
+REQUIRE(misses == 1000);
+REQUIRE(s.rehashes == 0);
+REQUIRE(s.size == 1000);
+REQUIRE(s.capacity == table.bucket_count());
+REQUIRE(s.tombstones == 0);
+REQUIRE(s.max_cluster >= 1);
+REQUIRE(s.bytes_allocated >= s.capacity * (sizeof(std::pair<const int, int>) + 1));
+for (int i = 0; i < 100; ++i)
+    table.erase(i);
+for (int i = 1000; i < 2000; ++i)
+    table.insert(i, i);
+s = table.stats();
+REQUIRE(s.rehashes >= 1);
+REQUIRE(s.tombstones <= 100);
+std::ostringstream report;
+report << s;
+REQUIRE(report.str().find("hit probe lengths") != std::string::npos);
+REQUIRE(report.str().find("rehashes") != std::string::npos);
+}
+SECTION("a bad hash shows up as long probes") {
+hash_map<size_t, int, identity_hash, std::equal_to<size_t>, My_allocator<std::pair<const size_t, int>>,
+        stats_policy> table(1 << 12);
+for (size_t i = 0; i < 1000; ++i)
+    table.insert(i << 40, 0);
+for (size_t i = 0; i < 1000; ++i)
+    table.contains(i << 40);
+hash_map_stats s = table.stats();
+REQUIRE(s.max_cluster >= 1000);
+REQUIRE(hash_map_stats::mean_probe_length(s.hit_probes) > 8);
+}
+SECTION("robin hood and incremental policies") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>,
+        stats_robin_hood_policy> robin;
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>,
+        stats_incremental_policy> incremental;
+for (int i = 0; i < 5000; ++i) {
+    robin.insert(i, i);
+    incremental.insert(i, i);
+}
+REQUIRE(robin.stats().tombstones == 0);
+REQUIRE(robin.stats().rehashes > 5);
+REQUIRE(incremental.stats().rehashes > 5);
+REQUIRE(incremental.stats().rehash_time.count() > 0);
+}
+}
 
-#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
-#include "catch.hpp"
+TEST_CASE("cost of disabled statistics", "[.][benchmark]") {
+std::vector<int> keys(1 << 16);
+for (int i = 0; i < 1 << 16; ++i)
+    keys[i] = i;
+hash_map<int, int> plain;
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>, stats_policy> counted;
+for (int key : keys) {
+    plain.insert(key, key);
+    counted.insert(key, key);
+}
+BENCHMARK("find, stats off") {
+    size_t found = 0;
+    for (int key : keys)
+        found += plain.contains(key);
+    return found;
+};
+BENCHMARK("find, stats on") {
+    size_t found = 0;
+    for (int key : keys)
+        found += counted.contains(key);
+    return found;
+};
+}
 
-TEST_CASE("LAB2") {
-SECTION("") {
-allocator<int> alloc;
-int *place = alloc.allocate(15);
-REQUIRE(*place == 15);
+struct steady_tracing_policy : incremental_rehash_policy {
+    using tracer = latency_tracer<steady_clock_ticks>;
+};
+
+TEST_CASE("latency tracing") {
+SECTION("histogram buckets") {
+latency_histogram h;
+REQUIRE(h.percentile(0.99) == 0);
+for (uint64_t v = 1; v <= 1000; ++v)
+    h.record(v);
+REQUIRE(h.count() == 1000);
+REQUIRE(h.max() == 1000);
+REQUIRE(h.percentile(0) == 1);
+REQUIRE(h.percentile(0.5) >= 500);
+REQUIRE(h.percentile(0.5) <= 500 + 500 / 16);
+REQUIRE(h.percentile(0.99) >= 990);
+REQUIRE(h.percentile(1) == 1000);
+h.record(std::numeric_limits<uint64_t>::max());
+REQUIRE(h.percentile(1) == std::numeric_limits<uint64_t>::max());
+h.reset();
+REQUIRE(h.count() == 0);
 }
-SECTION("") {
-allocator<int> alloc;
-int *data = alloc.allocate(50);
-alloc.deallocate(data, 50);
+SECTION("every operation is recorded") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>,
+        tracing_policy> table;
+table.tracer().set_name("sessions");
+for (int i = 0; i < 1000; ++i)
+    table.insert(i, i);
+for (int i = 0; i < 1000; ++i)
+    table.contains(i);
+for (int i = 0; i < 10; ++i)
+    table.erase(i);
+REQUIRE(table.tracer().histogram(trace_op::insert).count() == 1000);
+REQUIRE(table.tracer().histogram(trace_op::find).count() == 1000);
+REQUIRE(table.tracer().histogram(trace_op::erase).count() == 10);
+REQUIRE(table.tracer().histogram(trace_op::rehash).count() >= 5);
+REQUIRE(table.tracer().percentile_ns(trace_op::rehash, 1) >= table.tracer().percentile_ns(trace_op::find, 0.5));
+std::ostringstream report;
+report << table.tracer();
+REQUIRE(report.str().find("sessions insert: count 1000") != std::string::npos);
+}
+SECTION("incremental resizes with steady_clock") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>,
+        steady_tracing_policy> table;
+for (int i = 0; i < 1000; ++i)
+    table.insert(i, i);
+REQUIRE(table.tracer().histogram(trace_op::insert).count() == 1000);
+REQUIRE(table.tracer().histogram(trace_op::rehash).count() >= 5);
+}
+SECTION("tracing off adds nothing") {
+REQUIRE(std::is_empty<no_tracer>::value);
+REQUIRE(std::is_empty<no_tracer::scope>::value);
 }
-SECTION("") {
-hash_map<int, int>
-        table({{21, 1},
-               {0, 23},
-               {2, 3},
-               {-1, 11},
-               {-12, 11},
-               {21, 1}});
-hash_map<int, int> other_table(table.get_allocator());
-// table.insert(std::make_pair(7, 1));
-// table.insert(std::make_pair(2, 2));
-// table.insert(std::make_pair(3, 3));
 }
 
-SECTION("") {
-hash_map<std::string, int> table(7);
-REQUIRE(table.bucket_count() == 7);
-REQUIRE(table.size() == 0);
-REQUIRE(table.empty());
+TEST_CASE("tombstone compaction") {
+SECTION("churn keeps the table size") {
+hash_map<int, std::string, std::hash<int>, std::equal_to<int>,
+        My_allocator<std::pair<const int, std::string>>, stats_policy> table;
+for (int i = 0; i < 1000; ++i)
+    table.insert(i, std::to_string(i));
+// 1000 of 2048 slots is more than half the load allowed, so the first
+// tombstones make it grow once; after that it only compacts.
+size_t buckets = table.bucket_count() * 2;
+for (int i = 1000; i < 200000; ++i) {
+    table.insert(i, std::to_string(i));
+    table.erase(i - 1000);
+    REQUIRE(table.stats().tombstones <= buckets / 2);
 }
-SECTION("") {
-hash_map<std::string, int> table;
+REQUIRE(table.bucket_count() == buckets);
+REQUIRE(table.size() == 1000);
+REQUIRE(table.stats().rehashes > 0);
+for (int i = 0; i < 200000; ++i) {
+    auto it = table.find(i);
+    if (i < 199000)
+        REQUIRE(it == table.end());
+    else
+        REQUIRE(it->second == std::to_string(i));
+}
+size_t seen = 0;
+for (auto it = table.begin(); it != table.end(); ++it)
+    ++seen;
+REQUIRE(seen == 1000);
+}
+SECTION("other bucket indexes and tiny tables") {
+hash_map<size_t, size_t, std::hash<size_t>, std::equal_to<size_t>,
+        My_allocator<std::pair<const size_t, size_t>>, pow2_policy> pow2;
+hash_map<size_t, size_t, identity_hash, std::equal_to<size_t>,
+        My_allocator<std::pair<const size_t, size_t>>, modulo_policy> clustered(64);
+hash_map<int, int> tiny;
+for (size_t i = 0; i < 50000; ++i) {
+    pow2.insert(i, i);
+    clustered.insert(i * 64, i);
+    tiny.insert(static_cast<int>(i), 0);
+    if (i >= 20) {
+        pow2.erase(i - 20);
+        clustered.erase((i - 20) * 64);
+    }
+    if (i >= 3)
+        tiny.erase(static_cast<int>(i - 3));
+}
+REQUIRE(pow2.size() == 20);
+REQUIRE(clustered.size() == 20);
+REQUIRE(tiny.size() == 3);
+REQUIRE(tiny.bucket_count() == 16);
+for (size_t i = 49980; i < 50000; ++i) {
+    REQUIRE(pow2.at(i) == i);
+    REQUIRE(clustered.at(i * 64) == i);
+}
+REQUIRE(tiny.contains(49999));
+REQUIRE_FALSE(tiny.contains(49996));
+}
+}
+
+struct stats_shrink_policy : shrink_policy {
+    static constexpr bool collect_stats = true;
+};
+
+TEST_CASE("shrinking") {
+SECTION("shrink_to_fit") {
+hash_map<int, std::string> table;
+for (int i = 0; i < 100000; ++i)
+    table.insert(i, std::to_string(i));
+size_t peak = table.bucket_count();
+for (int i = 100; i < 100000; ++i)
+    table.erase(i);
+REQUIRE(table.bucket_count() == peak);
+table.rehash(16);
+REQUIRE(table.bucket_count() == peak);
+table.shrink_to_fit();
+REQUIRE(table.bucket_count() == 200);
+for (int i = 0; i < 100; ++i)
+    REQUIRE(table.at(i) == std::to_string(i));
+table.insert(100, "100");
+REQUIRE(table.bucket_count() == 400);
+table.clear();
+REQUIRE(table.bucket_count() == 400);
+table.shrink_to_fit();
 REQUIRE(table.bucket_count() == 0);
-REQUIRE(table.size() == 0);
-REQUIRE(table.empty());
+REQUIRE(table.begin() == table.end());
+table.insert(1, "1");
+REQUIRE(table.at(1) == "1");
+}
+SECTION("shrink policy follows the live set") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>,
+        stats_shrink_policy> table;
+for (int i = 0; i < 100000; ++i)
+    table.insert(i, i);
+for (int i = 0; i < 99000; ++i)
+    table.erase(i);
+REQUIRE(table.size() == 1000);
+REQUIRE(table.bucket_count() <= 1000 / 0.125);
+REQUIRE(table.bucket_count() >= 1000 / 0.5);
+for (int i = 99000; i < 100000; ++i)
+    REQUIRE(table.at(i) == i);
+table.clear();
+REQUIRE(table.bucket_count() == 0);
+table.insert(5, 5);
+REQUIRE(table.at(5) == 5);
+}
+SECTION("hysteresis stops grow/shrink thrash") {
+hash_map<int, int, std::hash<int>, std::equal_to<int>, My_allocator<std::pair<const int, int>>,
+        stats_shrink_policy> table;
+for (int i = 0; i < 1024; ++i)
+    table.insert(i, i);
+table.reset_stats();
+for (int round = 0; round < 1000; ++round) {
+    table.insert(1024, 0);
+    table.erase(1024);
+}
+REQUIRE(table.stats().rehashes <= 2);
+}
+}
+
+struct short_probe_policy : hash_map_policy {
+    static constexpr std::size_t max_probe_length = 64;
+};
+
+TEST_CASE("max load factor") {
+SECTION("load_factor and its bounds") {
+hash_map<int, int> table;
 REQUIRE(table.load_factor() == 0);
+REQUIRE(table.max_load_factor() == 0.5f);
+table = hash_map<int, int>(64);
+for (int i = 0; i < 16; ++i)
+    table.insert(i, i);
+REQUIRE(table.load_factor() == 0.25f);
+REQUIRE_THROWS_AS(table.max_load_factor(0), std::invalid_argument);
+REQUIRE_THROWS_AS(table.max_load_factor(1), std::invalid_argument);
+REQUIRE_THROWS_AS(table.max_load_factor(-0.5f), std::invalid_argument);
+REQUIRE(table.max_load_factor() == 0.5f);
+table.max_load_factor(0.2f);
+REQUIRE(table.bucket_count() >= 80);
+for (int i = 0; i < 16; ++i)
+    REQUIRE(table.at(i) == i);
+hash_map<int, int> copy(table);
+REQUIRE(copy.max_load_factor() == 0.2f);
 }
-SECTION("") {
-hash_map<std::string, int> table(2);
-std::pair<std::string, int> element{"yes", 1};
-// table.insert(element);
-// REQUIRE(table.begin()->first == "yes");
-// REQUIRE(table.begin()->second == 1);
+SECTION("dense tables fill to 7/8") {
+std::mt19937_64 rng(11);
+hash_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+        My_allocator<std::pair<const uint64_t, uint64_t>>, dense_policy> dense(1 << 16);
+hash_map<uint64_t, uint64_t> sparse(1 << 16);
+std::vector<uint64_t> keys(57000);
+for (auto &key : keys) {
+    key = rng();
+    dense.insert(key, key);
+    sparse.insert(key, key);
 }
-SECTION("") {
-std::vector<std::pair<std::string, int>> elements(9);
-elements[0] = {"death", 1};
-elements[1] = {"rest", 2};
-elements[2] = {"in", 3};
-elements[3] = {"peace", 4};
-elements[4] = {"help", 5};
-// fefu::hash_map<std::string, int> table(elements.begin(), elements.end());
-// std::cout « table.contains("death");
+REQUIRE(dense.max_load_factor() == 0.875f);
+REQUIRE(dense.bucket_count() == 1 << 16);
+REQUIRE(sparse.bucket_count() == 1 << 17);
+for (auto key : keys)
+    REQUIRE(dense.at(key) == key);
+for (size_t i = 0; i < 40000; ++i)
+    dense.erase(keys[i]);
+for (size_t i = 0; i < 40000; ++i)
+    dense.insert(i, i);
+REQUIRE(dense.size() == 57000);
+REQUIRE(dense.bucket_count() == 1 << 16);
+for (size_t i = 40000; i < keys.size(); ++i)
+    REQUIRE(dense.at(keys[i]) == keys[i]);
 }
-//SECTION("") {
-//hash_map<std::string, int> table
-//        ({{"death", 1}, {"rest", 23}, {"help", 3}, {"my", 11}, {"give", 11}});
-//REQUIRE(table.cbegin() == table.cend());
-//}
-SECTION("") {
-hash_map<int, int> table(10);
-table[6] = -120;
-table[2] = 12;
-REQUIRE(table[6] == -120);
-REQUIRE(table[2] == 12);
+SECTION("long probes grow the table early") {
+// identity_hash sends every small key to slot 0, so each insert walks the whole cluster.
+hash_map<size_t, size_t, identity_hash, std::equal_to<size_t>, My_allocator<std::pair<const size_t, size_t>>,
+        short_probe_policy> clustered(1024);
+hash_map<size_t, size_t, std::hash<size_t>, std::equal_to<size_t>, My_allocator<std::pair<const size_t, size_t>>,
+        short_probe_policy> spread(1024);
+for (size_t i = 0; i < 200; ++i) {
+    clustered.insert(i, i);
+    spread.insert(i, i);
+}
+REQUIRE(clustered.bucket_count() == 1024);
+for (size_t i = 200; i < 300; ++i) {
+    clustered.insert(i, i);
+    spread.insert(i, i);
+}
+REQUIRE(clustered.bucket_count() > 1024);
+REQUIRE(spread.bucket_count() == 1024);
+for (size_t i = 0; i < 300; ++i)
+    REQUIRE(clustered.at(i) == i);
+}
+}
+
+/// Sends every key to the same pair of buckets.
+struct constant_hash {
+    size_t operator()(uint64_t) const {
+        return 42;
+    }
+};
+
+TEST_CASE("cuckoo hashing") {
+SECTION("buckets fit in a cache line") {
+REQUIRE(cuckoo_hash_map<uint32_t, uint32_t>::inline_values);
+REQUIRE(cuckoo_hash_map<uint64_t, uint32_t>::inline_values);
+REQUIRE_FALSE(cuckoo_hash_map<uint64_t, uint64_t>::inline_values);
+}
+SECTION("insert, find and erase") {
+cuckoo_hash_map<uint64_t, uint64_t> table;
+for (uint64_t i = 0; i < 100000; ++i)
+    REQUIRE(table.insert(i * 4096, i));
+REQUIRE_FALSE(table.insert(4096, 0));
+REQUIRE_FALSE(table.insert_or_assign(4096, 7));
+for (uint64_t i = 0; i < 100000; i += 2)
+    REQUIRE(table.erase(i * 4096));
+REQUIRE_FALSE(table.erase(0));
+REQUIRE(table.size() == 50000);
+for (uint64_t i = 0; i < 100000; ++i)
+    REQUIRE(table.contains(i * 4096) == (i % 2 == 1));
+REQUIRE(table.at(4096) == 7);
+REQUIRE_THROWS_AS(table.at(1), std::out_of_range);
+cuckoo_hash_map<uint64_t, uint64_t> copy(table);
+uint64_t sum = 0;
+copy.for_each([&sum](uint64_t, uint64_t value) { sum += value; });
+REQUIRE(sum == 2500000000ull - 1 + 7);
+cuckoo_hash_map<uint64_t, uint64_t> moved(std::move(copy));
+REQUIRE(moved.size() == 50000);
+REQUIRE(copy.empty());
+REQUIRE(copy.insert(2, 2));
+REQUIRE(copy.at(2) == 2);
+}
+SECTION("95% occupancy without growing") {
+const size_t size = 1 << 18;
+cuckoo_hash_map<uint64_t, uint32_t> table(size);
+size_t buckets = table.bucket_count();
+std::mt19937_64 rng(23);
+std::vector<uint64_t> keys(size);
+for (size_t i = 0; i < size; ++i) {
+    keys[i] = rng();
+    table.insert(keys[i], static_cast<uint32_t>(i));
+}
+REQUIRE(table.bucket_count() == buckets);
+REQUIRE(table.load_factor() > 0.94f);
+for (size_t i = 0; i < size; ++i)
+    REQUIRE(table.at(keys[i]) == i);
+for (size_t i = 0; i < size; i += 2)
+    table.erase(keys[i]);
+for (size_t i = 0; i < size; i += 2)
+    table.insert(~keys[i], 0);
+REQUIRE(table.bucket_count() == buckets);
+REQUIRE(table.size() == size);
 }
+SECTION("stash") {
+cuckoo_hash_map<uint64_t, uint64_t, constant_hash> table;
+const size_t fits = 2 * cuckoo_hash_map<uint64_t, uint64_t>::slots_per_bucket +
+                    cuckoo_hash_map<uint64_t, uint64_t>::stash_size;
+for (uint64_t i = 0; i < fits; ++i)
+    table.insert(i, i);
+REQUIRE(table.stash_count() == cuckoo_hash_map<uint64_t, uint64_t>::stash_size);
+REQUIRE_THROWS_AS(table.insert(fits, 0), std::length_error);
+REQUIRE(table.size() == fits);
+for (uint64_t i = 0; i < fits; ++i)
+    REQUIRE(table.at(i) == i);
+REQUIRE(table.erase(0));
+REQUIRE(table.erase(fits - 1));
+REQUIRE(table.stash_count() < cuckoo_hash_map<uint64_t, uint64_t>::stash_size);
+for (uint64_t i = 1; i + 1 < fits; ++i)
+    REQUIRE(table.at(i) == i);
+}
+}
+
+TEST_CASE("cuckoo versus linear probing", "[.][benchmark]") {
+const int size = 1 << 22;
+std::vector<uint64_t> keys(size);
+std::mt19937_64 rng(29);
+for (auto &key : keys)
+    key = rng();
+std::vector<uint64_t> probes(1 << 20);
+for (auto &probe : probes)
+    probe = keys[rng() % size];
+
+hash_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+        My_allocator<std::pair<const uint64_t, uint64_t>>, dense_policy> linear(size * 8 / 7 + 1);
+cuckoo_hash_map<uint64_t, uint64_t> cuckoo(size);
+for (int i = 0; i < size; ++i) {
+    linear.insert(keys[i], i);
+    cuckoo.insert(keys[i], i);
+}
+BENCHMARK("hash_map at 7/8") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += linear.find(key)->second;
+    return sum;
+};
+BENCHMARK("cuckoo_hash_map at 95%") {
+    uint64_t sum = 0;
+    for (uint64_t key : probes)
+        sum += *cuckoo.find(key);
+    return sum;
+};
 }